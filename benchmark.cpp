@@ -0,0 +1,413 @@
+/*
+ * Signal-to-slot benchmark for the Unix signal watcher.
+ *
+ * Usage: sigwatch-benchmark [latency|throughput|burst|stress] [options]
+ *
+ *   latency     Sends one real-time signal at a time and measures the time
+ *               from sigqueue() to the slot, reporting p50/p99/p99.9.
+ *   throughput  Sends signals as fast as the kernel accepts them from another
+ *               thread and reports the sustained rate and the losses.
+ *   burst       Raises a burst of signals in the handler's own thread, which
+ *               the kernel delivers one by one, and reports the losses.
+ *   stress      Sends three real-time signals, queued, coalesced and queued
+ *               with HighPriority, from several threads and child processes
+ *               at once, and checks that for each the deliveries received,
+ *               coalesced and dropped add up exactly to those sent. Exits with
+ *               status 1 otherwise.
+ *
+ *   -n <count>  Number of signals to send (default 100000, 10000 for latency;
+ *               for stress, of each signal by each sender, default 10000).
+ *   --threads <n>    Sending threads for stress (default 4).
+ *   --processes <n>  Sending child processes for stress (default 2).
+ *   --batch     Count deliveries through unixSignalsBatch() instead of one
+ *               slot call per signal.
+ *   --direct    Count deliveries with a handler passed to watchForSignal()
+ *               instead of a slot, bypassing the Qt signals.
+ *   --coalesce  Watch SIGUSR1 with CoalesceSignals instead of a queued
+ *               real-time signal (throughput and burst only).
+ *
+ * The back-end is chosen at build time, e.g. "qmake CONFIG+=sigwatch_signalfd",
+ * and so are sanitizers, e.g. "qmake CONFIG+=sanitizer CONFIG+=sanitize_thread".
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sigwatch.h"
+
+static qint64 nowNanoseconds()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static const char *backendName()
+{
+#if defined(SIGWATCH_SIGNALFD)
+    return "signalfd";
+#elif defined(SIGWATCH_SIGWAIT)
+    return "sigwait";
+#elif defined(Q_OS_LINUX) && !defined(SIGWATCH_NO_EVENTFD)
+    return "handler+eventfd";
+#else
+    return "handler+pipe";
+#endif
+}
+
+/*
+ * Queues a signal, retrying while the kernel's per-user queue is full.
+ */
+static void sendSignal(int signal, int value)
+{
+    union sigval sigValue;
+    sigValue.sival_int = value;
+    while (::sigqueue(::getpid(), signal, sigValue) && errno == EAGAIN)
+        std::this_thread::yield();
+}
+
+class Benchmark : public QObject
+{
+public:
+    Benchmark(const QString &mode, int count, bool batch, bool direct, bool coalesce) :
+        mode(mode), count(count), batch(batch), direct(direct), coalesce(coalesce),
+        received(0), dropped(0), coalesced(0)
+    {
+        signal = coalesce ? SIGUSR1 : UnixSignalWatcher::realTimeSignal(1);
+        const UnixSignalWatcher::WatchOptions options = coalesce ? UnixSignalWatcher::CoalesceSignals
+                                                                 : UnixSignalWatcher::QueueSignals;
+        if (mode == "latency")
+            receiveTimes.resize(count);
+
+        if (direct) {
+            // The Qt signals are bypassed, coalescing is read from the statistics
+            const bool timed = mode == "latency";
+            watcher.watchForSignal(signal, [this, timed](const UnixSignalInfo &info) {
+                if (timed)
+                    receiveTimes[info.value] = nowNanoseconds();
+                received.fetch_add(1);
+                coalesced = int(watcher.statistics(signal).coalesced);
+            }, options);
+        } else if (batch) {
+            watcher.watchForSignal(signal, options);
+            connect(&watcher, &UnixSignalWatcher::unixSignalsBatch,
+                    [this](const QVector<int> &signalBatch) { received += signalBatch.count(); });
+        } else if (mode == "latency") {
+            watcher.watchForSignal(signal, options);
+            connect(&watcher, &UnixSignalWatcher::unixSignalInfo,
+                    [this](const UnixSignalInfo &info) {
+                        receiveTimes[info.value] = nowNanoseconds();
+                        received.fetch_add(1);
+                    });
+        } else {
+            watcher.watchForSignal(signal, options);
+            connect(&watcher, &UnixSignalWatcher::unixSignal, [this](int) { received += 1; });
+        }
+        connect(&watcher, &UnixSignalWatcher::unixSignalCoalesced,
+                [this](int, int n) { coalesced += n - 1; });
+        connect(&watcher, &UnixSignalWatcher::unixSignalsDropped,
+                [this](int, int n) { dropped += n; });
+    }
+
+    void run()
+    {
+        elapsed.start();
+        if (mode == "latency")
+            runLatency();
+        else if (mode == "throughput")
+            runThroughput();
+        else
+            runBurst();
+    }
+
+private:
+    void send(int value)
+    {
+        if (coalesce)
+            ::kill(::getpid(), signal);
+        else
+            sendSignal(signal, value);
+    }
+
+    // One signal in flight at a time, sent from another thread
+    void runLatency()
+    {
+        sendTimes.resize(count);
+        sender = std::thread([this]() {
+            for (int i = 0; i < count; ++i) {
+                sendTimes[i] = nowNanoseconds();
+                sendSignal(signal, i);
+                while (received.load() <= i)
+                    std::this_thread::yield();
+            }
+        });
+        waitForCompletion();
+    }
+
+    // As fast as possible from another thread
+    void runThroughput()
+    {
+        sender = std::thread([this]() {
+            for (int i = 0; i < count; ++i)
+                send(i);
+        });
+        waitForCompletion();
+    }
+
+    // Synchronously delivered in this thread, the event loop cannot keep up
+    void runBurst()
+    {
+        for (int i = 0; i < count; ++i)
+            send(i);
+        waitForCompletion();
+    }
+
+    void waitForCompletion()
+    {
+        QTimer *timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, [this]() {
+            if (received + dropped + coalesced < count && elapsed.elapsed() < 30000)
+                return;
+            if (sender.joinable())
+                sender.join();
+            report();
+            QCoreApplication::quit();
+        });
+        timer->start(10);
+    }
+
+    void report()
+    {
+        QTextStream out(stdout);
+        const double seconds = elapsed.nsecsElapsed() / 1e9;
+        out << mode << " backend=" << backendName()
+            << " signal=" << (coalesce ? "SIGUSR1/coalesced" : "SIGRTMIN+1/queued")
+            << " delivery=" << (direct ? "direct" : batch ? "batch" : "per-signal") << "\n";
+        out << "  sent " << count << ", received " << int(received)
+            << ", coalesced " << int(coalesced) << ", dropped " << int(dropped)
+            << ", unaccounted " << count - received - coalesced - dropped << "\n";
+
+        if (mode == "latency" && (direct || !batch)) {
+            QVector<qint64> latencies;
+            for (int i = 0; i < count; ++i)
+                latencies.append(receiveTimes[i] - sendTimes[i]);
+            std::sort(latencies.begin(), latencies.end());
+            out << "  latency us: p50 " << percentile(latencies, 0.5) / 1e3
+                << "  p99 " << percentile(latencies, 0.99) / 1e3
+                << "  p99.9 " << percentile(latencies, 0.999) / 1e3
+                << "  max " << latencies.last() / 1e3 << "\n";
+        } else {
+            out << "  " << qint64((received + coalesced) / seconds)
+                << " signals/s over " << seconds << " s\n";
+        }
+    }
+
+    static qint64 percentile(const QVector<qint64> &sorted, double p)
+    {
+        return sorted.at(qMin(sorted.count() - 1, int(p * sorted.count())));
+    }
+
+    UnixSignalWatcher watcher;
+    QString mode;
+    int count;
+    bool batch;
+    bool direct;
+    bool coalesce;
+    int signal;
+    std::atomic<int> received;
+    std::atomic<int> dropped;
+    std::atomic<int> coalesced;
+    QVector<qint64> sendTimes;
+    QVector<qint64> receiveTimes;
+    QElapsedTimer elapsed;
+    std::thread sender;
+};
+
+/*
+ * Checks the loss accounting of every delivery mode under load. Real-time
+ * signals are used because the kernel queues each of them, so every one sent
+ * reaches the handler and has to show up as received, coalesced or dropped.
+ */
+class StressTest : public QObject
+{
+public:
+    StressTest(int count, int threads, int processes) :
+        count(count), threads(threads), processes(processes), passed(true)
+    {
+        const Watched watched[] = {
+            { UnixSignalWatcher::realTimeSignal(1), UnixSignalWatcher::QueueSignals, "queued" },
+            { UnixSignalWatcher::realTimeSignal(2), UnixSignalWatcher::CoalesceSignals, "coalesced" },
+            { UnixSignalWatcher::realTimeSignal(3), UnixSignalWatcher::QueueSignals
+                                                    | UnixSignalWatcher::HighPriority, "high-priority" }
+        };
+        for (int i = 0; i < SignalCount; ++i) {
+            signals_[i] = watched[i];
+            received[i] = coalesced[i] = dropped[i] = 0;
+            watcher.watchForSignal(signals_[i].signal, signals_[i].options);
+        }
+
+        connect(&watcher, &UnixSignalWatcher::unixSignal,
+                [this](int signal) { received[indexOf(signal)] += 1; });
+        connect(&watcher, &UnixSignalWatcher::unixSignalCoalesced,
+                [this](int signal, int n) { coalesced[indexOf(signal)] += n - 1; });
+        connect(&watcher, &UnixSignalWatcher::unixSignalsDropped,
+                [this](int signal, int n) { dropped[indexOf(signal)] += n; });
+
+        // The children only send, they need no watcher
+        UnixSignalWatcher::setForkPolicy(UnixSignalWatcher::DisableInChild);
+    }
+
+    void run()
+    {
+        elapsed.start();
+        const pid_t parent = ::getpid();
+
+        // Fork before starting any thread, so that the children have one
+        for (int i = 0; i < processes; ++i) {
+            const pid_t pid = ::fork();
+            if (pid == 0) {
+                sendAll(parent);
+                ::_exit(0);
+            }
+            if (pid < 0)
+                passed = false;
+            else
+                children.append(pid);
+        }
+        for (int i = 0; i < threads; ++i)
+            senders.push_back(std::thread([this, parent]() { sendAll(parent); }));
+
+        QTimer *timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, [this]() {
+            if (!isComplete() && elapsed.elapsed() < 30000)
+                return;
+            for (size_t i = 0; i < senders.size(); ++i)
+                senders[i].join();
+            for (int i = 0; i < children.count(); ++i) {
+                int status = 0;
+                if (::waitpid(children.at(i), &status, 0) < 0 || !WIFEXITED(status)
+                        || WEXITSTATUS(status) != 0)
+                    passed = false;
+            }
+            report();
+            QCoreApplication::exit(passed ? 0 : 1);
+        });
+        timer->start(10);
+    }
+
+private:
+    enum { SignalCount = 3 };
+
+    struct Watched
+    {
+        int signal;
+        UnixSignalWatcher::WatchOptions options;
+        const char *name;
+    };
+
+    int indexOf(int signal) const
+    {
+        for (int i = 0; i < SignalCount; ++i) {
+            if (signals_[i].signal == signal)
+                return i;
+        }
+        return 0;
+    }
+
+    // Interleaves the signals, so that every mode is under load at once
+    void sendAll(pid_t pid)
+    {
+        union sigval sigValue;
+        for (int i = 0; i < count; ++i) {
+            sigValue.sival_int = i;
+            for (int j = 0; j < SignalCount; ++j) {
+                while (::sigqueue(pid, signals_[j].signal, sigValue) && errno == EAGAIN)
+                    std::this_thread::yield();
+            }
+        }
+    }
+
+    int sent() const { return count * (threads + processes); }
+
+    bool isComplete() const
+    {
+        for (int i = 0; i < SignalCount; ++i) {
+            if (received[i] + coalesced[i] + dropped[i] < sent())
+                return false;
+        }
+        return true;
+    }
+
+    void report()
+    {
+        QTextStream out(stdout);
+        out << "stress backend=" << backendName() << " threads=" << threads
+            << " processes=" << processes << " seconds=" << elapsed.nsecsElapsed() / 1e9 << "\n";
+
+        for (int i = 0; i < SignalCount; ++i) {
+            // The statistics must agree with what was emitted
+            const UnixSignalStatistics stats = watcher.statistics(signals_[i].signal);
+            const qint64 accounted = qint64(received[i]) + coalesced[i] + dropped[i];
+            const bool ok = accounted == sent()
+                    && qint64(stats.delivered + stats.coalesced + stats.dropped) == accounted;
+            passed = passed && ok;
+            out << "  " << signals_[i].name << ": sent " << sent() << ", received " << int(received[i])
+                << ", coalesced " << int(coalesced[i]) << ", dropped " << int(dropped[i])
+                << (ok ? "  OK" : "  MISMATCH") << "\n";
+        }
+        out << (passed ? "PASSED" : "FAILED") << "\n";
+    }
+
+    UnixSignalWatcher watcher;
+    int count;
+    int threads;
+    int processes;
+    Watched signals_[SignalCount];
+    std::atomic<int> received[SignalCount];
+    std::atomic<int> coalesced[SignalCount];
+    std::atomic<int> dropped[SignalCount];
+    bool passed;
+    QVector<pid_t> children;
+    std::vector<std::thread> senders;
+    QElapsedTimer elapsed;
+};
+
+static int intOption(const QStringList &args, const QString &name, int defaultValue)
+{
+    const int i = args.indexOf(name);
+    return i >= 0 && i + 1 < args.count() ? args.at(i + 1).toInt() : defaultValue;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    const QString mode = args.isEmpty() || args.first().startsWith('-') ? "latency" : args.first();
+    const bool batch = args.contains("--batch");
+    const bool direct = args.contains("--direct");
+    const bool coalesce = args.contains("--coalesce") && mode != "latency";
+    const int count = intOption(args, "-n", mode == "latency" ? 10000 : mode == "stress" ? 10000 : 100000);
+
+    if (mode == "stress") {
+        StressTest stress(count, intOption(args, "--threads", 4), intOption(args, "--processes", 2));
+        QTimer::singleShot(0, &stress, [&stress]() { stress.run(); });
+        return app.exec();
+    }
+
+    Benchmark benchmark(mode, count, batch, direct, coalesce);
+    QTimer::singleShot(0, &benchmark, [&benchmark]() { benchmark.run(); });
+    return app.exec();
+}
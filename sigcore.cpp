@@ -0,0 +1,2320 @@
+/*
+ * Async-signal-safe core of the Unix signal watcher.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sigcore.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <QMutex>
+#include <QThread>
+
+#include <algorithm>
+#include <atomic>
+
+#ifndef SIGWATCH_LOGGING_CATEGORY
+#define SIGWATCH_LOGGING_CATEGORY "sigwatch"
+#endif
+
+// Debug output, such as each caught signal, is disabled unless enabled with a
+// logging rule, e.g. QT_LOGGING_RULES="sigwatch.debug=true".
+Q_LOGGING_CATEGORY(lcSigwatch, SIGWATCH_LOGGING_CATEGORY, QtWarningMsg)
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <ucontext.h>
+#include <pthread.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+#ifndef SIGWATCH_QUEUE_CAPACITY
+#define SIGWATCH_QUEUE_CAPACITY 1024
+#endif
+
+// How long a console close or shutdown may wait for SIGTERM to be passed on,
+// in milliseconds. Windows ends the process about 5 s after the event anyway.
+#ifndef SIGWATCH_CONSOLE_CLOSE_TIMEOUT
+#define SIGWATCH_CONSOLE_CLOSE_TIMEOUT 4000
+#endif
+
+#if defined(Q_OS_LINUX) && !defined(SIGWATCH_NO_EVENTFD)
+#define SIGWATCH_HAVE_EVENTFD
+#include <sys/eventfd.h>
+#elif defined(Q_OS_LINUX) || defined(Q_OS_FREEBSD) || defined(Q_OS_NETBSD) || defined(Q_OS_OPENBSD)
+#define SIGWATCH_HAVE_PIPE2
+#endif
+
+#if defined(Q_OS_LINUX) && defined(SIGWATCH_SIGNALFD)
+#define SIGWATCH_HAVE_SIGNALFD
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#endif // Q_OS_LINUX && SIGWATCH_SIGNALFD
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN) && defined(SIGWATCH_SIGWAIT) \
+    && !defined(SIGWATCH_HAVE_SIGNALFD)
+#define SIGWATCH_HAVE_SIGWAIT
+
+// The signal the sigwait thread is sent when its set of signals changes. It is
+// reserved and cannot be watched.
+#ifndef SIGWATCH_WAKE_SIGNAL
+#define SIGWATCH_WAKE_SIGNAL SIGRTMAX
+#endif
+#endif // SIGWATCH_SIGWAIT
+
+// The signal handler may only use atomics that never fall back to a lock
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_POINTER_LOCK_FREE == 2,
+              "UnixSignalCore requires lock-free atomics");
+static_assert(SIGWATCH_QUEUE_CAPACITY > 0
+              && (SIGWATCH_QUEUE_CAPACITY & (SIGWATCH_QUEUE_CAPACITY - 1)) == 0,
+              "SIGWATCH_QUEUE_CAPACITY must be a power of two");
+
+namespace {
+
+/*!
+ * \brief The Doorbell class wakes up the core's thread from a signal handler.
+ *
+ * On Linux it is an \c eventfd(2), elsewhere on Unix a non-blocking pipe,
+ * watched by the event loop, e.g. through a QSocketNotifier. Both descriptors
+ * are close-on-exec so they do not leak into children. On Windows it is an
+ * auto-reset event, e.g. watched by a QWinEventNotifier. It carries no data:
+ * ringing it only wakes up the event loop, and clearing it re-arms it.
+ */
+class Doorbell
+{
+public:
+#if defined(Q_OS_WIN)
+    Doorbell() : event(0) {}
+#else
+    Doorbell() : readFd(-1), writeFd(-1) {}
+#endif
+
+    bool open();
+    void close();
+    void ring();    // async-signal-safe
+    void clear();
+#if !defined(Q_OS_WIN)
+    bool reopen();
+#endif
+
+#if defined(Q_OS_WIN)
+    HANDLE event;
+#else
+    int readFd;
+    int writeFd;
+#endif
+};
+
+#if defined(Q_OS_WIN)
+bool Doorbell::open()
+{
+    event = ::CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!event) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: CreateEvent: error" << ::GetLastError();
+        return false;
+    }
+    return true;
+}
+
+void Doorbell::close()
+{
+    if (event)
+        ::CloseHandle(event);
+    event = 0;
+}
+
+void Doorbell::ring()
+{
+    ::SetEvent(event);
+}
+
+void Doorbell::clear()
+{
+    // Auto-reset: the wait of the notifier has already reset the event
+}
+#else
+
+bool Doorbell::open()
+{
+#if defined(SIGWATCH_HAVE_EVENTFD)
+    readFd = writeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (readFd < 0) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: eventfd: " << ::strerror(errno);
+        return false;
+    }
+#else
+    int fds[2];
+#if defined(SIGWATCH_HAVE_PIPE2)
+    if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC)) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pipe2: " << ::strerror(errno);
+        return false;
+    }
+#else
+    if (::pipe(fds)) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pipe: " << ::strerror(errno);
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        ::fcntl(fds[i], F_SETFL, ::fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        ::fcntl(fds[i], F_SETFD, ::fcntl(fds[i], F_GETFD) | FD_CLOEXEC);
+    }
+#endif
+    readFd = fds[0];
+    writeFd = fds[1];
+#endif
+    return true;
+}
+
+void Doorbell::close()
+{
+    if (readFd >= 0)
+        ::close(readFd);
+    if (writeFd >= 0 && writeFd != readFd)
+        ::close(writeFd);
+    readFd = writeFd = -1;
+}
+
+void Doorbell::ring()
+{
+#if defined(SIGWATCH_HAVE_EVENTFD)
+    const quint64 one = 1;
+    ssize_t nBytes = ::write(writeFd, &one, sizeof(one));
+#else
+    const char one = 1;
+    ssize_t nBytes = ::write(writeFd, &one, sizeof(one));
+#endif
+    // A full pipe is still readable, so a failed write loses no wakeup
+    Q_UNUSED(nBytes);
+}
+
+void Doorbell::clear()
+{
+#if defined(SIGWATCH_HAVE_EVENTFD)
+    quint64 count;
+    ssize_t nBytes = ::read(readFd, &count, sizeof(count));
+    Q_UNUSED(nBytes);
+#else
+    char buffer[64];
+    while (::read(readFd, buffer, sizeof(buffer)) == sizeof(buffer))
+        ;
+#endif
+}
+
+/*!
+ * Makes \a target refer to what \a fd refers to, keeping it close-on-exec,
+ * and closes \a fd. Used after \c fork() to give a descriptor shared with the
+ * parent a private replacement under the same number, so that whatever waits
+ * on the number keeps working.
+ */
+bool replaceDescriptor(int fd, int target)
+{
+    int result;
+    while ((result = ::dup2(fd, target)) < 0 && errno == EINTR)
+        ;
+    if (result < 0) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: dup2: " << ::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    ::fcntl(target, F_SETFD, ::fcntl(target, F_GETFD) | FD_CLOEXEC);
+    ::close(fd);
+    return true;
+}
+
+/*!
+ * Replaces the descriptors, shared with the parent after \c fork(), by fresh
+ * ones under the same numbers.
+ */
+bool Doorbell::reopen()
+{
+    Doorbell fresh;
+    if (!fresh.open())
+        return false;
+
+    bool replaced = replaceDescriptor(fresh.readFd, readFd);
+    if (writeFd != readFd)
+        replaced = replaceDescriptor(fresh.writeFd, writeFd) && replaced;
+    return replaced;
+}
+#endif // Q_OS_WIN
+
+/*!
+ * Returns the current \c CLOCK_MONOTONIC time, or performance counter time on
+ * Windows, in nanoseconds. Async-signal-safe.
+ */
+qint64 monotonicNanoseconds()
+{
+#if defined(Q_OS_WIN)
+    LARGE_INTEGER counter, frequency;
+    ::QueryPerformanceCounter(&counter);
+    ::QueryPerformanceFrequency(&frequency);
+    return qint64(double(counter.QuadPart) * 1e9 / double(frequency.QuadPart));
+#else
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*!
+ * \brief The SignalQueue class is a bounded, lock-free queue of signal records.
+ *
+ * Any number of signal handlers, possibly on different threads or nested on
+ * the same one, may push() concurrently; only the draining thread pops. A
+ * single producer per signal cannot be assumed, since the same signal may be
+ * handled on several threads at once. Each cell carries a sequence number
+ * telling whether it is free, written, or still being written by an
+ * interrupted producer (D. Vyukov's bounded MPMC queue, used with a single
+ * consumer). push() only retries when another handler claimed the same cell
+ * first, so its retries are bounded by the number of concurrent handlers, and
+ * it never waits for the consumer: a full queue fails immediately.
+ *
+ * The capacity is set with \c SIGWATCH_QUEUE_CAPACITY and should cover the
+ * largest burst expected between two drains. isCrowded() tells producers
+ * when it is half full, so that queued signals can be left to the kernel.
+ */
+class SignalQueue
+{
+public:
+    enum { Capacity = SIGWATCH_QUEUE_CAPACITY };
+
+    SignalQueue();
+
+    bool push(const UnixSignalInfo &record);    // async-signal-safe
+    bool pop(UnixSignalInfo *record);
+    bool isCrowded() const;                     // async-signal-safe
+    void reset();
+
+private:
+    struct Cell
+    {
+        std::atomic<quint32> sequence;
+        UnixSignalInfo record;
+    };
+
+    // Keep the producers' and the consumer's index on separate cache lines
+    std::atomic<quint32> tail;  // next position to write
+    char padding[64];
+    std::atomic<quint32> head;  // next position to read, written by the consumer only
+    Cell cells[Capacity];
+};
+
+SignalQueue::SignalQueue()
+{
+    reset();
+}
+
+/*!
+ * Empties the queue. Only safe while nothing pushes, e.g. in the child after
+ * \c fork(), where the other threads are gone.
+ */
+void SignalQueue::reset()
+{
+    tail.store(0, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    for (quint32 i = 0; i < Capacity; ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/*!
+ * Appends \a record, returning false if the queue is full.
+ */
+bool SignalQueue::push(const UnixSignalInfo &record)
+{
+    quint32 pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell &cell = cells[pos % Capacity];
+        const quint32 sequence = cell.sequence.load(std::memory_order_acquire);
+        const qint32 diff = qint32(sequence - pos);
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.record = record;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/*!
+ * Removes the oldest completely written record into \a record, returning false
+ * if there is none.
+ */
+bool SignalQueue::pop(UnixSignalInfo *record)
+{
+    const quint32 pos = head.load(std::memory_order_relaxed);
+    Cell &cell = cells[pos % Capacity];
+    if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+        return false;
+
+    *record = cell.record;
+    cell.sequence.store(pos + Capacity, std::memory_order_release);
+    head.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+/*!
+ * Returns true if at least half of the queue is taken. The two indexes are
+ * read apart, so the answer is approximate while records come and go.
+ */
+bool SignalQueue::isCrowded() const
+{
+    const quint32 size = tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed);
+    return qint32(size) >= Capacity / 2;
+}
+
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD)
+/*!
+ * Returns the address of the instruction interrupted by a signal, read from
+ * the \c ucontext_t \a context passed to the handler, or 0 if unknown on this
+ * platform. Async-signal-safe.
+ */
+quintptr programCounter(const void *context)
+{
+    if (!context)
+        return 0;
+    const ucontext_t *uc = static_cast<const ucontext_t *>(context);
+#if defined(Q_OS_LINUX) && defined(__x86_64__)
+    return quintptr(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(Q_OS_LINUX) && defined(__i386__)
+    return quintptr(uc->uc_mcontext.gregs[REG_EIP]);
+#elif defined(Q_OS_LINUX) && defined(__aarch64__)
+    return quintptr(uc->uc_mcontext.pc);
+#elif defined(Q_OS_LINUX) && defined(__arm__)
+    return quintptr(uc->uc_mcontext.arm_pc);
+#elif defined(Q_OS_FREEBSD) && defined(__x86_64__)
+    return quintptr(uc->uc_mcontext.mc_rip);
+#elif defined(Q_OS_DARWIN) && defined(__x86_64__)
+    return quintptr(uc->uc_mcontext->__ss.__rip);
+#elif defined(Q_OS_DARWIN) && defined(__aarch64__)
+    return quintptr(uc->uc_mcontext->__ss.__pc);
+#else
+    Q_UNUSED(uc);
+    return 0;
+#endif
+}
+
+/*!
+ * Returns the record of a delivery of \a signal described by \a info,
+ * timestamped now. The interrupted \a context, if any, gives the program
+ * counter. Async-signal-safe.
+ */
+UnixSignalInfo recordFromSigInfo(int signal, const siginfo_t *info, const void *context)
+{
+    UnixSignalInfo record;
+    record.signal = signal;
+    record.timestamp = monotonicNanoseconds();
+    record.code = info->si_code;
+    record.pid = info->si_pid;
+    record.uid = info->si_uid;
+    record.status = info->si_status;
+    record.value = info->si_value.sival_int;
+    record.pointer = quintptr(info->si_value.sival_ptr);
+    record.programCounter = programCounter(context);
+    return record;
+}
+#endif // Q_OS_UNIX && !SIGWATCH_HAVE_SIGNALFD
+
+} // namespace
+
+/*!
+ * \brief The UnixSignalCorePrivate class implements the back-end signal
+ * handling for the UnixSignalCore.
+ *
+ * By default a signal handler pushes a record of each caught signal onto an
+ * in-memory queue and rings a doorbell descriptor, which wakes up the event
+ * loop to drain the queue. The doorbell is only rung when the core is not
+ * already awake, so a burst costs one wakeup. When built with
+ * \c SIGWATCH_SIGNALFD on Linux, the watched signals are instead blocked and
+ * read in batches from a \c signalfd(2), so no asynchronous handler is
+ * involved at all; the doorbell and the signalfd are then gathered in an
+ * \c epoll(7) set, so that the core still has a single descriptor to wait
+ * for. When built with \c SIGWATCH_SIGWAIT, they are blocked as well and a
+ * single internal thread collects them with \c sigwaitinfo(2) and queues them
+ * like the handler would, so no thread is ever interrupted by the watched
+ * signals.
+ *
+ * Any number of cores, up to \c MaxWatchers, may exist at the same time.
+ * Each has its own queue and doorbell and registers itself in a process-wide
+ * table. For every signal the table holds a bitmask of the cores interested
+ * in it, so the handler only notifies those cores.
+ *
+ * Signals watched with UnixSignalCore::HighPriority go into a second queue,
+ * which drain() empties first and checks again before each other record, so
+ * a burst of ordinary signals can neither delay nor crowd them out. The
+ * signalfd is only read once per drain, so there they go first in each batch.
+ *
+ * \see http://qt-project.org/doc/qt-5.0/qtdoc/unix-signals.html
+ */
+class UnixSignalCorePrivate
+{
+public:
+    UnixSignalCorePrivate();
+    ~UnixSignalCorePrivate();
+
+    bool watchSignal(int signal, int options);
+    void watchSignals(const int *signalList, int count, int options);
+    void unwatchSignal(int signal);
+#ifdef Q_OS_UNIX
+    static void signalHandler(int signal, siginfo_t *info, void *context);
+#else
+    static void signalHandler(int signal);
+    static BOOL WINAPI consoleCtrlHandler(DWORD type);
+#endif
+    bool isWatched(int signal) const;
+    bool isCoalesced(int signal) const;
+    bool isHighPriority(int signal) const;
+
+    int drain(const UnixSignalCore::Callback &callback,
+              const UnixSignalCore::DroppedCallback &dropped);
+    void reportDroppedSignals(const UnixSignalCore::DroppedCallback &dropped);
+    void updateStatistics(const UnixSignalInfo &record, int count);
+    UnixSignalStatistics statistics(int signal) const;
+    UnixSignalLatencyHistogram latencyHistogram(int signal) const;
+
+    static bool maskWatchedSignals(bool block);
+
+    enum { MaxWatchers = 32 };
+    enum { WatchedFlag = 0x10000 };
+
+    static bool deliverSignal(const UnixSignalInfo &record, UnixSignalCorePrivate *reader = 0);
+    bool notify(const UnixSignalInfo &record);
+    void queueSignal(const UnixSignalInfo &record);
+
+    static void uninstallSignal(int signal);
+
+#ifdef Q_OS_UNIX
+    static void prepareFork();
+    static void parentAfterFork();
+    static void childAfterFork();
+    void resetAfterFork();
+    static bool forkHandlersInstalled;
+#endif
+    static std::atomic<int> forkPolicy;
+    UnixSignalCore::ForkCallback forkCallback;
+
+    void drainQueue();
+    bool mayParkSignals() const;
+    void resumeParkedSignals();
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD)
+    static void resumeSignals(const sigset_t &parked);
+#endif
+    int passRecord(const UnixSignalInfo &record, const UnixSignalCore::Callback &callback);
+    int passPrioritySignals(const UnixSignalCore::Callback &callback);
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    void readSignalFd();
+#endif
+
+    bool valid;
+    QVector<int> watchedSignals;    // in watching order, see isWatched()
+    QVector<UnixSignalInfo> pendingSignals;
+
+    /*!
+     * Latency buckets of a signal, see UnixSignalLatencyHistogram. Allocated
+     * when the signal is first watched and kept until the core goes away.
+     */
+    struct LatencyBuckets
+    {
+        std::atomic<quint64> counts[UnixSignalLatencyHistogram::BucketCount];
+        std::atomic<quint64> overflow;
+    };
+
+    /*!
+     * Per-signal state of this core shared with the signal handler. Only
+     * lock-free atomics are accessed from the handler, which keeps it
+     * async-signal-safe.
+     */
+    struct SignalState
+    {
+        std::atomic<int> options;       // WatchOptions | WatchedFlag once watched
+        std::atomic<int> pending;       // deliveries not yet drained (coalesced)
+        std::atomic<quint32> dropped;   // records lost to a full queue
+        std::atomic<bool> parked;       // left pending in the kernel, see notify()
+        quint32 droppedReported;        // consumer only
+        qint64 watchedSince;            // consumer only, see passRecord()
+
+        // Statistics, updated by the draining thread and read by any thread
+        std::atomic<quint64> delivered;
+        std::atomic<quint64> coalesced;
+        std::atomic<int> maxQueueDepth;
+        std::atomic<qint64> totalLatency;
+        std::atomic<qint64> maxLatency;
+        std::atomic<LatencyBuckets *> latency;
+        int queueDepth;                 // consumer only, records per wakeup
+    };
+    SignalState signalStates[NSIG];
+    std::atomic<bool> queueOverflowed;
+    std::atomic<bool> signalsParked;
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD) && !defined(SIGWATCH_HAVE_SIGWAIT)
+    std::atomic<pthread_t> drainThread;     // the thread the handler parks signals in
+#endif
+    static void clearSignalState(SignalState &state);
+
+    /*!
+     * An entry in the process-wide table of cores. The handler counts itself
+     * in \c users while it dereferences \c watcher, and an unregistering
+     * core waits for \c users to drop to zero before it goes away.
+     */
+    struct WatcherSlot
+    {
+        std::atomic<UnixSignalCorePrivate *> watcher;
+        std::atomic<int> users;
+    };
+    static WatcherSlot watcherSlots[MaxWatchers];
+    static std::atomic<quint32> signalWatchers[NSIG];  // bitmask of slots
+    static bool signalInstalled[NSIG];
+#if defined(Q_OS_UNIX)
+    static struct sigaction previousActions[NSIG];     // restored on uninstall
+#elif defined(Q_OS_WIN)
+    typedef void (*CrtHandler)(int);
+    static CrtHandler previousHandlers[NSIG];
+#endif
+    static QMutex registryGuard;
+    int slot;
+
+    SignalQueue queue;
+    SignalQueue priorityQueue;      // HighPriority signals, drained first
+    Doorbell doorbell;
+    std::atomic<bool> doorbellRung;
+
+#ifdef Q_OS_WIN
+    static bool consoleHandlerInstalled;
+    static std::atomic<bool> consoleClosed;    // until a drain passes SIGTERM on
+    static HANDLE consoleDrained;               // set once it has
+#endif
+#ifdef Q_OS_UNIX
+#if defined(SIGWATCH_HAVE_SIGNALFD) || defined(SIGWATCH_HAVE_SIGWAIT)
+    static sigset_t signalMask;
+#endif
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    static int signalFd;
+    int epollFd;        // the doorbell and the signalfd
+    int createEpollSet() const;
+#endif
+#ifdef SIGWATCH_HAVE_SIGWAIT
+    static bool startSignalWaiter();
+    static void *waitForSignals(void *);
+    static void wakeSignalWaiter();
+    static bool signalWaiterStarted;
+    static pthread_t signalWaiter;
+    static std::atomic<int> signalMaskGeneration;
+#endif
+#endif
+};
+
+namespace {
+
+struct SignalName
+{
+    int signal;
+    const char *name;
+};
+
+const SignalName signalNames[] = {
+    { SIGINT,   "Interrupt" },
+    { SIGILL,   "Illegal instruction" },
+    { SIGABRT,  "Aborted" },
+    { SIGFPE,   "Arithmetic exception" },
+    { SIGSEGV,  "Segmentation fault" },
+    { SIGTERM,  "Terminated" },
+#ifdef SIGBREAK
+    { SIGBREAK, "Break" },
+#endif
+#ifdef SIGABRT_COMPAT
+    { SIGABRT_COMPAT, "Aborted" },
+#endif
+#ifdef Q_OS_UNIX
+    { SIGHUP,   "Hangup" },
+    { SIGQUIT,  "Quit" },
+    { SIGTRAP,  "Trace/breakpoint trap" },
+    { SIGBUS,   "Bus error" },
+    { SIGKILL,  "Killed" },
+    { SIGUSR1,  "User defined signal 1" },
+    { SIGUSR2,  "User defined signal 2" },
+    { SIGPIPE,  "Broken pipe" },
+    { SIGALRM,  "Alarm clock" },
+    { SIGCHLD,  "Child exited" },
+    { SIGCONT,  "Continued" },
+    { SIGSTOP,  "Stopped (signal)" },
+    { SIGTSTP,  "Stopped" },
+    { SIGTTIN,  "Stopped (tty input)" },
+    { SIGTTOU,  "Stopped (tty output)" },
+    { SIGURG,   "Urgent I/O condition" },
+    { SIGXCPU,  "CPU time limit exceeded" },
+    { SIGXFSZ,  "File size limit exceeded" },
+    { SIGVTALRM, "Virtual timer expired" },
+    { SIGPROF,  "Profiling timer expired" },
+    { SIGSYS,   "Bad system call" },
+#endif
+#ifdef SIGWINCH
+    { SIGWINCH, "Window changed" },
+#endif
+#ifdef SIGIO
+    { SIGIO,    "I/O possible" },
+#endif
+#ifdef SIGPWR
+    { SIGPWR,   "Power failure" },
+#endif
+#ifdef SIGSTKFLT
+    { SIGSTKFLT, "Stack fault" },
+#endif
+};
+
+/*!
+ * Signal descriptions indexed by signal number.
+ */
+struct SignalNameTable
+{
+    const char *names[NSIG];
+
+    SignalNameTable()
+    {
+        for (int i = 0; i < NSIG; ++i)
+            names[i] = "Unknown signal";
+#ifdef SIGRTMIN
+        for (int i = SIGRTMIN; i <= SIGRTMAX && i < NSIG; ++i)
+            names[i] = "Real-time signal";
+#endif
+        for (size_t i = 0; i < sizeof(signalNames) / sizeof(signalNames[0]); ++i)
+            names[signalNames[i].signal] = signalNames[i].name;
+    }
+};
+
+} // namespace
+
+UnixSignalCorePrivate::WatcherSlot UnixSignalCorePrivate::watcherSlots[MaxWatchers];
+std::atomic<quint32> UnixSignalCorePrivate::signalWatchers[NSIG];
+bool UnixSignalCorePrivate::signalInstalled[NSIG];
+#if defined(Q_OS_UNIX)
+struct sigaction UnixSignalCorePrivate::previousActions[NSIG];
+#elif defined(Q_OS_WIN)
+UnixSignalCorePrivate::CrtHandler UnixSignalCorePrivate::previousHandlers[NSIG];
+#endif
+QMutex UnixSignalCorePrivate::registryGuard;
+
+#if defined(SIGWATCH_HAVE_SIGNALFD) || defined(SIGWATCH_HAVE_SIGWAIT)
+sigset_t UnixSignalCorePrivate::signalMask;
+#endif
+#ifdef SIGWATCH_HAVE_SIGNALFD
+int UnixSignalCorePrivate::signalFd = -1;
+#endif
+#ifdef Q_OS_WIN
+bool UnixSignalCorePrivate::consoleHandlerInstalled = false;
+std::atomic<bool> UnixSignalCorePrivate::consoleClosed(false);
+HANDLE UnixSignalCorePrivate::consoleDrained = 0;
+#endif
+#ifdef Q_OS_UNIX
+bool UnixSignalCorePrivate::forkHandlersInstalled = false;
+#endif
+std::atomic<int> UnixSignalCorePrivate::forkPolicy(UnixSignalCore::RearmInChild);
+#ifdef SIGWATCH_HAVE_SIGWAIT
+bool UnixSignalCorePrivate::signalWaiterStarted = false;
+pthread_t UnixSignalCorePrivate::signalWaiter;
+std::atomic<int> UnixSignalCorePrivate::signalMaskGeneration(0);
+#endif
+
+
+UnixSignalCorePrivate::UnixSignalCorePrivate() :
+    valid(false),
+    queueOverflowed(false),
+    signalsParked(false),
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD) && !defined(SIGWATCH_HAVE_SIGWAIT)
+    drainThread(::pthread_self()),
+#endif
+    slot(-1)
+{
+    for (int i = 0; i < NSIG; ++i) {
+        signalStates[i].options.store(0);
+        signalStates[i].latency.store(0);
+        signalStates[i].watchedSince = 0;
+        clearSignalState(signalStates[i]);
+    }
+
+    doorbellRung.store(false);
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    epollFd = -1;
+#endif
+
+    if (!doorbell.open())
+        return;
+
+    QMutexLocker lck(&registryGuard);
+
+#ifdef Q_OS_UNIX
+    if (!forkHandlersInstalled) {
+        const int error = ::pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+        if (error)
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_atfork: " << ::strerror(error);
+        forkHandlersInstalled = !error;
+    }
+#endif
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    // The signalfd is shared by all cores, signals are added as they are
+    // watched. Every core listens on it and fans out what it reads.
+    if (signalFd < 0) {
+        ::sigemptyset(&signalMask);
+        signalFd = ::signalfd(-1, &signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signalFd < 0) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: signalfd: " << ::strerror(errno);
+            return;
+        }
+    }
+
+    epollFd = createEpollSet();
+    if (epollFd < 0)
+        return;
+#endif
+
+    for (int i = 0; i < MaxWatchers; ++i) {
+        if (!watcherSlots[i].watcher.load()) {
+            watcherSlots[i].watcher.store(this);
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0)
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: too many watchers, at most"
+                              << int(MaxWatchers) << "are supported";
+    valid = slot >= 0;
+}
+
+UnixSignalCorePrivate::~UnixSignalCorePrivate()
+{
+    // Restores the previous disposition of signals nobody else watches
+    while (!watchedSignals.isEmpty())
+        unwatchSignal(watchedSignals.last());
+
+    if (slot >= 0) {
+        QMutexLocker lck(&registryGuard);
+
+        // Wait for handlers that may still be writing to this core
+        WatcherSlot &entry = watcherSlots[slot];
+        entry.watcher.store(0);
+        while (entry.users.load() > 0)
+            QThread::yieldCurrentThread();
+    }
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    if (epollFd >= 0)
+        ::close(epollFd);
+#endif
+    doorbell.close();
+
+    for (int i = 0; i < NSIG; ++i)
+        delete signalStates[i].latency.load();
+}
+
+/*!
+ * Zeroes the \a state of a signal but its options: nothing pending, dropped
+ * or counted.
+ */
+void UnixSignalCorePrivate::clearSignalState(SignalState &state)
+{
+    state.pending.store(0);
+    state.dropped.store(0);
+    state.parked.store(false);
+    state.droppedReported = 0;
+    state.delivered.store(0);
+    state.coalesced.store(0);
+    state.maxQueueDepth.store(0);
+    state.totalLatency.store(0);
+    state.maxLatency.store(0);
+    state.queueDepth = 0;
+    if (LatencyBuckets *buckets = state.latency.load()) {
+        for (int i = 0; i < UnixSignalLatencyHistogram::BucketCount; ++i)
+            buckets->counts[i].store(0);
+        buckets->overflow.store(0);
+    }
+}
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+/*!
+ * Returns a new epoll set of the doorbell and the signalfd, or -1.
+ */
+int UnixSignalCorePrivate::createEpollSet() const
+{
+    const int fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: epoll_create1: " << ::strerror(errno);
+        return -1;
+    }
+    const int fds[] = { doorbell.readFd, signalFd };
+    for (int i = 0; i < 2; ++i) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fds[i];
+        if (::epoll_ctl(fd, EPOLL_CTL_ADD, fds[i], &event)) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: epoll_ctl: " << ::strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+#endif
+
+#ifdef Q_OS_UNIX
+/*!
+ * Runs in the forking thread before \c fork(). Holds the registryGuard across
+ * the fork, so that the child gets the registry in a consistent state.
+ */
+void UnixSignalCorePrivate::prepareFork()
+{
+    registryGuard.lock();
+}
+
+/*!
+ * Runs in the parent after \c fork(), which keeps watching as before.
+ */
+void UnixSignalCorePrivate::parentAfterFork()
+{
+    registryGuard.unlock();
+}
+
+/*!
+ * Runs in the child after \c fork(), where only the forking thread is left.
+ *
+ * The child inherits the doorbells, the signalfd and the epoll sets as
+ * descriptors shared with the parent, so either process could consume the
+ * other's wakeups, and the signalfd mask would be changed for both. Each is
+ * replaced by a private one under the same number, so that notifiers waiting
+ * on fd() keep working. The queues, pending counts and statistics, copies of
+ * the parent's, are cleared, and the sigwait thread, which did not survive
+ * the fork, is started again.
+ *
+ * With UnixSignalCore::DisableInChild, every core stops watching instead and
+ * the signals get their previous dispositions back, as if each had been
+ * unwatched. The fork callbacks run last, with the registry unlocked.
+ */
+void UnixSignalCorePrivate::childAfterFork()
+{
+    // Handlers interrupted on the parent's other threads never finish here
+    for (int i = 0; i < MaxWatchers; ++i)
+        watcherSlots[i].users.store(0);
+
+#ifdef SIGWATCH_HAVE_SIGWAIT
+    // Nor did the signal thread, which must not be woken up meanwhile
+    signalWaiterStarted = false;
+#endif
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    if (signalFd >= 0) {
+        const int fresh = ::signalfd(-1, &signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fresh < 0)
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: signalfd: " << ::strerror(errno);
+        else
+            replaceDescriptor(fresh, signalFd);
+    }
+#endif
+
+    for (int i = 0; i < MaxWatchers; ++i) {
+        if (UnixSignalCorePrivate *d = watcherSlots[i].watcher.load())
+            d->resetAfterFork();
+    }
+
+    const bool disable = forkPolicy.load() == UnixSignalCore::DisableInChild;
+    if (disable) {
+        for (int i = 0; i < MaxWatchers; ++i) {
+            UnixSignalCorePrivate *d = watcherSlots[i].watcher.load();
+            if (!d)
+                continue;
+            for (int j = 0; j < d->watchedSignals.count(); ++j)
+                d->signalStates[d->watchedSignals.at(j)].options.store(0);
+            d->watchedSignals.clear();
+        }
+        for (int signal = 1; signal < NSIG; ++signal) {
+            signalWatchers[signal].store(0);
+            uninstallSignal(signal);
+        }
+    }
+
+#ifdef SIGWATCH_HAVE_SIGWAIT
+    // Starting the thread empties the mask, which still holds what to wait for
+    bool waited = false;
+    for (int signal = 1; signal < NSIG && !waited; ++signal)
+        waited = signalInstalled[signal];
+    if (waited) {
+        const sigset_t mask = signalMask;
+        startSignalWaiter();
+        signalMask = mask;
+    }
+#endif
+
+    registryGuard.unlock();
+
+    for (int i = 0; i < MaxWatchers; ++i) {
+        UnixSignalCorePrivate *d = watcherSlots[i].watcher.load();
+        if (d && d->forkCallback)
+            d->forkCallback();
+    }
+}
+
+/*!
+ * Gives this core private descriptors and forgets the signals caught by the
+ * parent. Called in the child after \c fork(), with the registryGuard held.
+ */
+void UnixSignalCorePrivate::resetAfterFork()
+{
+    queue.reset();
+    priorityQueue.reset();
+    pendingSignals.clear();
+    queueOverflowed.store(false);
+    signalsParked.store(false);
+    for (int i = 0; i < NSIG; ++i)
+        clearSignalState(signalStates[i]);
+
+    if (!doorbell.reopen())
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: could not replace the doorbell after fork()";
+    doorbellRung.store(false);
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    const int fresh = epollFd >= 0 ? createEpollSet() : -1;
+    if (fresh >= 0)
+        replaceDescriptor(fresh, epollFd);
+#endif
+}
+#endif // Q_OS_UNIX
+
+/*!
+ * Registers a handler for the given Unix \a signal. The handler will queue a
+ * UnixSignalInfo record and ring the doorbell, which the event loop watches.
+ * This provides a way to break out of the asynchronous context from which the
+ * signal handler is called and back into the event loop.
+ *
+ * The handler is installed once per process and shared by all cores; each
+ * core only adds itself to the set of cores interested in \a signal.
+ *
+ * With the signalfd and sigwait back-ends, the \a signal is blocked in the
+ * calling thread and added to the signalfd mask, or to the set waited for by
+ * the signal thread, instead. Threads inherit the signal mask of their
+ * creator, so signals should be watched from the main thread before any other
+ * threads are started; a thread which does not block the signal would
+ * otherwise receive it with its default disposition.
+ *
+ * With UnixSignalCore::CoalesceSignals in \a options, deliveries of the
+ * \a signal are counted and only the first delivery since the last drain
+ * wakes up the event loop. UnixSignalCore::QueueSignals implies SignalInfo
+ * and disables coalescing; its deliveries are left pending in the kernel
+ * while the queue is crowded, see notify(). With
+ * UnixSignalCore::HighPriority, the records of \a signal are queued apart and
+ * passed on before any other.
+ */
+bool UnixSignalCorePrivate::watchSignal(int signal, int options)
+{
+    if (signal <= 0 || signal >= NSIG) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: invalid signal" << signal;
+        return false;
+    }
+
+    // Queued signals are reported one by one, each with its details
+    if (options & UnixSignalCore::QueueSignals) {
+        options |= UnixSignalCore::SignalInfo;
+        options &= ~int(UnixSignalCore::CoalesceSignals);
+    }
+
+    if (isWatched(signal)) {
+        signalStates[signal].options.store(options | WatchedFlag);
+        qCDebug(lcSigwatch) << "Already watching for signal" << signal;
+        return true;
+    }
+
+    if (!valid)
+        return false;
+
+#ifdef SIGWATCH_HAVE_SIGWAIT
+    if (signal == SIGWATCH_WAKE_SIGNAL) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: signal" << signal
+                              << "is reserved for waking up the signal thread";
+        return false;
+    }
+#endif
+
+    // Records of an earlier watch may still be queued, see passRecord()
+    SignalState &state = signalStates[signal];
+    state.watchedSince = monotonicNanoseconds();
+    if (!state.latency.load()) {
+        LatencyBuckets *buckets = new LatencyBuckets;
+        for (int i = 0; i < UnixSignalLatencyHistogram::BucketCount; ++i)
+            buckets->counts[i].store(0, std::memory_order_relaxed);
+        buckets->overflow.store(0, std::memory_order_relaxed);
+        state.latency.store(buckets);
+    }
+
+    QMutexLocker lck(&registryGuard);
+
+    if (!signalInstalled[signal]) {
+#if defined(SIGWATCH_HAVE_SIGNALFD) || defined(SIGWATCH_HAVE_SIGWAIT)
+#if defined(SIGWATCH_HAVE_SIGNALFD)
+        if (signalFd < 0)
+            return false;
+#else
+        if (!startSignalWaiter())
+            return false;
+#endif
+
+        // Block the signal so that it stays pending until read from the
+        // signalfd or collected by the signal thread
+        sigset_t blocked;
+        ::sigemptyset(&blocked);
+        ::sigaddset(&blocked, signal);
+        int error = ::pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+        if (error) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_sigmask: " << ::strerror(error);
+            return false;
+        }
+
+        ::sigaddset(&signalMask, signal);
+#if defined(SIGWATCH_HAVE_SIGNALFD)
+        if (::signalfd(signalFd, &signalMask, 0) < 0) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: signalfd: " << ::strerror(errno);
+            ::sigdelset(&signalMask, signal);
+            return false;
+        }
+#else
+        wakeSignalWaiter();
+#endif
+
+#elif defined(Q_OS_UNIX)
+        // Register a sigaction which will notify the cores. The
+        // siginfo_t costs nothing extra, so it is always requested. The
+        // handler runs with every signal blocked: a nested handler would
+        // return to a mask that undoes the parking of its signal.
+        struct sigaction sigact;
+        sigact.sa_sigaction = UnixSignalCorePrivate::signalHandler;
+        ::sigfillset(&sigact.sa_mask);
+        sigact.sa_flags = SA_RESTART | SA_SIGINFO;
+        if (::sigaction(signal, &sigact, &previousActions[signal])) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: sigaction: " << ::strerror(errno);
+            return false;
+        }
+
+#elif defined(Q_OS_WIN)
+        // Register a CRT signal handler, which catches raise() and faults
+        CrtHandler previous = ::signal(signal, UnixSignalCorePrivate::signalHandler);
+        if (previous == SIG_ERR) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: signal: " << ::strerror(errno);
+            return false;
+        }
+        previousHandlers[signal] = previous;
+
+        // Console events are caught before the CRT turns them into signals,
+        // which it would do on a thread of its own while holding a lock
+        if ((signal == SIGINT || signal == SIGTERM || signal == SIGBREAK)
+                && !consoleHandlerInstalled) {
+            consoleDrained = ::CreateEventW(NULL, TRUE, FALSE, NULL);
+            if (!consoleDrained) {
+                qCWarning(lcSigwatch) << "UnixSignalWatcher: CreateEvent: error" << ::GetLastError();
+                return false;
+            }
+            if (!::SetConsoleCtrlHandler(UnixSignalCorePrivate::consoleCtrlHandler, TRUE)) {
+                qCWarning(lcSigwatch) << "UnixSignalWatcher: SetConsoleCtrlHandler: error"
+                                      << ::GetLastError();
+                return false;
+            }
+            consoleHandlerInstalled = true;
+        }
+
+#else
+#   error "UnixSignalCore is not supported on this system"
+#endif
+        signalInstalled[signal] = true;
+    }
+
+    signalStates[signal].options.store(options | WatchedFlag);
+    signalWatchers[signal].fetch_or(1u << slot);
+    watchedSignals.append(signal);
+    return true;
+}
+
+/*!
+ * Watches the \a count signals in \a signalList with the same \a options.
+ *
+ * With the signal handler back-end, all of them are blocked in the calling
+ * thread while their handlers are installed, so one arriving half-way through
+ * stays pending until every handler is in place instead of possibly finding
+ * the next still at its default disposition. The signalfd and sigwait
+ * back-ends block the signals anyway.
+ */
+void UnixSignalCorePrivate::watchSignals(const int *signalList, int count, int options)
+{
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD) && !defined(SIGWATCH_HAVE_SIGWAIT)
+    sigset_t blocked, previous;
+    ::sigemptyset(&blocked);
+    for (int i = 0; i < count; ++i) {
+        if (signalList[i] > 0 && signalList[i] < NSIG)
+            ::sigaddset(&blocked, signalList[i]);
+    }
+    int error = ::pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    if (error)
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_sigmask: " << ::strerror(error);
+#endif
+
+    for (int i = 0; i < count; ++i)
+        watchSignal(signalList[i], options);
+
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD) && !defined(SIGWATCH_HAVE_SIGWAIT)
+    if (!error)
+        ::pthread_sigmask(SIG_SETMASK, &previous, NULL);
+#endif
+}
+
+/*!
+ * Stops watching \a signal. Records of it still queued are discarded. If no
+ * other core watches it, its handler is uninstalled.
+ */
+void UnixSignalCorePrivate::unwatchSignal(int signal)
+{
+    if (signal <= 0 || signal >= NSIG || !isWatched(signal))
+        return;
+
+    SignalState &state = signalStates[signal];
+    state.options.store(0);
+    state.pending.store(0);
+    watchedSignals.removeAll(signal);
+
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD)
+    // Take a parked signal back before its old disposition may return. The
+    // handler ignores the deliveries still pending, now that it is unwatched.
+    // From another thread, the next drain takes it back instead.
+    if (mayParkSignals() && state.parked.exchange(false)) {
+        sigset_t parked;
+        ::sigemptyset(&parked);
+        ::sigaddset(&parked, signal);
+        resumeSignals(parked);
+    }
+#endif
+
+    QMutexLocker lck(&registryGuard);
+    const quint32 bit = 1u << slot;
+    if ((signalWatchers[signal].fetch_and(~bit) & ~bit) == 0)
+        uninstallSignal(signal);
+}
+
+/*!
+ * Gives \a signal back to its previous disposition once no core is left
+ * for it. Must be called with the registryGuard held.
+ *
+ * With the signalfd and sigwait back-ends, the \a signal is removed from the
+ * set of signals read, deliveries still pending are discarded, and it is
+ * unblocked in the calling thread. Other threads keep it blocked.
+ */
+void UnixSignalCorePrivate::uninstallSignal(int signal)
+{
+    if (!signalInstalled[signal])
+        return;
+
+#if defined(SIGWATCH_HAVE_SIGNALFD) || defined(SIGWATCH_HAVE_SIGWAIT)
+    ::sigdelset(&signalMask, signal);
+#if defined(SIGWATCH_HAVE_SIGNALFD)
+    if (::signalfd(signalFd, &signalMask, 0) < 0)
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: signalfd: " << ::strerror(errno);
+#else
+    wakeSignalWaiter();
+#endif
+
+    // Pending deliveries would get the default action once unblocked
+    sigset_t unwatched;
+    ::sigemptyset(&unwatched);
+    ::sigaddset(&unwatched, signal);
+    static const struct timespec noWait = { 0, 0 };
+    while (::sigtimedwait(&unwatched, NULL, &noWait) > 0)
+        ;
+    ::pthread_sigmask(SIG_UNBLOCK, &unwatched, NULL);
+
+#elif defined(Q_OS_UNIX)
+    if (::sigaction(signal, &previousActions[signal], NULL))
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: sigaction: " << ::strerror(errno);
+
+#elif defined(Q_OS_WIN)
+    // The console handler stays, it lets events nobody watches through
+    ::signal(signal, previousHandlers[signal]);
+#endif
+
+    signalInstalled[signal] = false;
+    qCDebug(lcSigwatch) << "Uninstalled signal" << signal;
+}
+
+/*!
+ * Blocks, or unblocks if \a block is false, every signal installed so far in
+ * the calling thread.
+ */
+bool UnixSignalCorePrivate::maskWatchedSignals(bool block)
+{
+#if defined(Q_OS_UNIX)
+    sigset_t watched;
+    ::sigemptyset(&watched);
+    {
+        QMutexLocker lck(&registryGuard);
+        for (int i = 1; i < NSIG; ++i) {
+            if (signalInstalled[i])
+                ::sigaddset(&watched, i);
+        }
+    }
+
+    int error = ::pthread_sigmask(block ? SIG_BLOCK : SIG_UNBLOCK, &watched, NULL);
+    if (error) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_sigmask: " << ::strerror(error);
+        return false;
+    }
+
+#if !defined(SIGWATCH_HAVE_SIGNALFD) && !defined(SIGWATCH_HAVE_SIGWAIT)
+    // Signals parked in this thread are now blocked on purpose, so that the
+    // next drain must not unblock them
+    if (block) {
+        QMutexLocker lck(&registryGuard);
+        for (int i = 0; i < MaxWatchers; ++i) {
+            UnixSignalCorePrivate *d = watcherSlots[i].watcher.load();
+            if (!d || !d->mayParkSignals())
+                continue;
+            for (int signal = 1; signal < NSIG; ++signal)
+                d->signalStates[signal].parked.store(false);
+        }
+    }
+#endif
+    return true;
+#else
+    Q_UNUSED(block);
+    return false;
+#endif
+}
+
+#ifdef SIGWATCH_HAVE_SIGWAIT
+/*!
+ * Starts the process-wide signal thread unless it is already running. The
+ * thread is created with every signal blocked, so that it only ever receives
+ * signals through \c sigwaitinfo(). Must be called with the registryGuard
+ * held.
+ */
+bool UnixSignalCorePrivate::startSignalWaiter()
+{
+    if (signalWaiterStarted)
+        return true;
+
+    sigset_t all, previous;
+    ::sigfillset(&all);
+    ::pthread_sigmask(SIG_SETMASK, &all, &previous);
+
+    int error = ::pthread_create(&signalWaiter, NULL, waitForSignals, NULL);
+    ::pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (error) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_create: " << ::strerror(error);
+        return false;
+    }
+
+    ::pthread_detach(signalWaiter);
+    ::sigemptyset(&signalMask);
+    signalWaiterStarted = true;
+    return true;
+}
+
+/*!
+ * Tells the signal thread that its set of signals has changed, by sending it
+ * \c SIGWATCH_WAKE_SIGNAL. The signal is queued for the thread if it is not
+ * waiting yet, so no change can be missed.
+ */
+void UnixSignalCorePrivate::wakeSignalWaiter()
+{
+    signalMaskGeneration.fetch_add(1);
+    if (!signalWaiterStarted)
+        return;
+
+    // EAGAIN means a wakeup is already pending
+    int error = ::pthread_kill(signalWaiter, SIGWATCH_WAKE_SIGNAL);
+    if (error && error != EAGAIN)
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_kill: " << ::strerror(error);
+}
+
+/*!
+ * Body of the signal thread. Waits for the watched signals and queues each of
+ * them to the interested cores exactly like the signal handler, then rings
+ * their doorbells, which are only written once per wakeup of a core.
+ *
+ * The wait has no timeout: wakeSignalWaiter() interrupts it with
+ * \c SIGWATCH_WAKE_SIGNAL whenever the set changes, and the set is reloaded.
+ */
+void *UnixSignalCorePrivate::waitForSignals(void *)
+{
+    sigset_t waited;
+    ::sigemptyset(&waited);
+    int generation = -1;
+
+    for (;;) {
+        if (signalMaskGeneration.load() != generation) {
+            QMutexLocker lck(&registryGuard);
+            waited = signalMask;
+            generation = signalMaskGeneration.load();
+        }
+        ::sigaddset(&waited, SIGWATCH_WAKE_SIGNAL);
+
+        siginfo_t info;
+        const int signal = ::sigwaitinfo(&waited, &info);
+        if (signal == SIGWATCH_WAKE_SIGNAL)
+            continue;
+        if (signal > 0) {
+            // Leave a queued signal with no room left to the kernel until the
+            // core has drained its queue and reloads the mask
+            if (deliverSignal(recordFromSigInfo(signal, &info, 0)))
+                ::sigdelset(&waited, signal);
+        }
+        else if (errno != EINTR)
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: sigwaitinfo: " << ::strerror(errno);
+    }
+    return 0;
+}
+#endif // SIGWATCH_HAVE_SIGWAIT
+
+/*!
+ * Called when a Unix \a signal is received. Forwards the signal to every
+ * core interested in it.
+ *
+ * This runs in the asynchronous context of the signal handler, so it only
+ * touches lock-free atomics and rings the doorbells. On Windows the CRT calls
+ * it on the faulting or raising thread; console events go through
+ * consoleCtrlHandler() instead. Either way the records are drained later, in
+ * the core's thread.
+ */
+#ifdef Q_OS_UNIX
+void UnixSignalCorePrivate::signalHandler(int signal, siginfo_t *info, void *context)
+{
+#if defined(SIGWATCH_HAVE_SIGNALFD) || defined(SIGWATCH_HAVE_SIGWAIT)
+    // Not used: signals are read from the signalfd or the signal thread
+    Q_UNUSED(signal);
+    Q_UNUSED(info);
+    Q_UNUSED(context);
+#else
+    const int savedErrno = errno;
+
+    // A queued signal with little room left stays blocked in this thread,
+    // the draining one, once the handler returns, so that the kernel keeps
+    // the next ones pending
+    if (deliverSignal(recordFromSigInfo(signal, info, context)) && context)
+        ::sigaddset(&static_cast<ucontext_t *>(context)->uc_sigmask, signal);
+
+    errno = savedErrno;
+#endif
+}
+#else
+void UnixSignalCorePrivate::signalHandler(int signal)
+{
+    // The CRT resets the handler to SIG_DFL before calling it
+    ::signal(signal, UnixSignalCorePrivate::signalHandler);
+
+    UnixSignalInfo record = UnixSignalInfo();
+    record.signal = signal;
+    record.timestamp = monotonicNanoseconds();
+    deliverSignal(record);
+}
+
+/*!
+ * Called by Windows on a thread of its own for console events. Maps them to
+ * the signals the CRT would raise, \c SIGINT for Ctrl+C, \c SIGBREAK for
+ * Ctrl+Break and \c SIGTERM for closing the console or shutting down, and
+ * queues them like the signal handler does.
+ *
+ * Windows ends the process as soon as a close or shutdown event returns, so
+ * the handler waits, at most \c SIGWATCH_CONSOLE_CLOSE_TIMEOUT ms, until a
+ * drain has passed SIGTERM on, e.g. emitted UnixSignalWatcher::terminated().
+ * Events arriving meanwhile wait for the same SIGTERM rather than queueing
+ * another one.
+ *
+ * Logging off is ignored: a service or a process started before the session
+ * must not stop whenever any user logs off. Returns FALSE for events nobody
+ * watches, so that the default processing, e.g. terminating the process on
+ * Ctrl+C, still happens.
+ */
+BOOL WINAPI UnixSignalCorePrivate::consoleCtrlHandler(DWORD type)
+{
+    int signal;
+    switch (type) {
+    case CTRL_C_EVENT: signal = SIGINT; break;
+    case CTRL_BREAK_EVENT: signal = SIGBREAK; break;
+    case CTRL_CLOSE_EVENT:
+    case CTRL_SHUTDOWN_EVENT: signal = SIGTERM; break;
+    default: return FALSE;
+    }
+
+    if (!signalWatchers[signal].load())
+        return FALSE;
+
+    const bool closing = signal == SIGTERM;
+    if (!closing || !consoleClosed.exchange(true)) {
+        if (closing)
+            ::ResetEvent(consoleDrained);
+        UnixSignalInfo record = UnixSignalInfo();
+        record.signal = signal;
+        record.timestamp = monotonicNanoseconds();
+        deliverSignal(record);
+    }
+
+    if (closing)
+        ::WaitForSingleObject(consoleDrained, SIGWATCH_CONSOLE_CLOSE_TIMEOUT);
+    return TRUE;
+}
+#endif
+
+/*!
+ * Forwards the signal in \a record to each core registered for it. The
+ * \a reader, if any, is the core that read the signal from the signalfd; it
+ * queues the signal for itself directly instead of ringing its own doorbell.
+ * Returns true if a core asked for the signal to be left pending in the
+ * kernel until it has drained its queue.
+ */
+bool UnixSignalCorePrivate::deliverSignal(const UnixSignalInfo &record, UnixSignalCorePrivate *reader)
+{
+    bool park = false;
+    quint32 mask = signalWatchers[record.signal].load();
+    for (int i = 0; mask; ++i, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+
+        WatcherSlot &entry = watcherSlots[i];
+        entry.users.fetch_add(1);
+        UnixSignalCorePrivate *d = entry.watcher.load();
+        if (d == reader)
+            d->queueSignal(record);
+        else if (d)
+            park = d->notify(record) || park;
+        entry.users.fetch_sub(1);
+    }
+    return park;
+}
+
+/*!
+ * Wakes up this core for the signal in \a record. Async-signal-safe on Unix.
+ *
+ * The \a record is pushed onto the queue and the doorbell rung unless it has
+ * been rung since the core last woke up. A coalesced signal is only queued
+ * when its pending count goes from zero to one, so a burst of it occupies a
+ * single slot in the queue.
+ *
+ * Returns true if the signal is watched with UnixSignalCore::QueueSignals,
+ * its queue is at least half full and mayParkSignals() allows it. The handler
+ * or the signal thread then stops taking it from the kernel, which keeps
+ * further deliveries queued until drain() has made room; the rest of the
+ * queue is left for the threads that still take it meanwhile.
+ */
+bool UnixSignalCorePrivate::notify(const UnixSignalInfo &record)
+{
+    // The slot may have been reused by a core not interested in the signal
+    SignalState &state = signalStates[record.signal];
+    const int options = state.options.load();
+    if (!(options & WatchedFlag))
+        return false;
+
+    if (isCoalesced(record.signal) && state.pending.fetch_add(1) != 0)
+        return false;
+
+    // A coalesced signal stays counted in pending, anything else is lost
+    SignalQueue &target = isHighPriority(record.signal) ? priorityQueue : queue;
+    if (!target.push(record)) {
+        if (!isCoalesced(record.signal))
+            state.dropped.fetch_add(1);
+        queueOverflowed.store(true);
+    }
+
+    bool park = false;
+    if ((options & UnixSignalCore::QueueSignals) && target.isCrowded() && mayParkSignals()) {
+        state.parked.store(true);
+        signalsParked.store(true);
+        park = true;
+    }
+
+    if (!doorbellRung.exchange(true))
+        doorbell.ring();
+    return park;
+}
+
+/*!
+ * Queues \a record to be passed on by the current drain(),
+ * counting coalesced signals the same way notify() does.
+ */
+void UnixSignalCorePrivate::queueSignal(const UnixSignalInfo &record)
+{
+    SignalState &state = signalStates[record.signal];
+    if (!(state.options.load() & WatchedFlag))
+        return;
+    if (isCoalesced(record.signal) && state.pending.fetch_add(1) != 0)
+        return;
+    pendingSignals.append(record);
+}
+
+/*!
+ * Returns true if this core watches \a signal. Constant time, unlike a
+ * lookup in watchedSignals.
+ */
+bool UnixSignalCorePrivate::isWatched(int signal) const
+{
+    return signalStates[signal].options.load(std::memory_order_relaxed) & WatchedFlag;
+}
+
+/*!
+ * Returns true if deliveries of \a signal are coalesced by this core. Safe
+ * to call from the signal handler.
+ */
+bool UnixSignalCorePrivate::isCoalesced(int signal) const
+{
+    return signalStates[signal].options.load(std::memory_order_relaxed)
+            & UnixSignalCore::CoalesceSignals;
+}
+
+/*!
+ * Returns true if \a signal is watched with UnixSignalCore::HighPriority by
+ * this core. Safe to call from the signal handler.
+ */
+bool UnixSignalCorePrivate::isHighPriority(int signal) const
+{
+    return signalStates[signal].options.load(std::memory_order_relaxed)
+            & UnixSignalCore::HighPriority;
+}
+
+
+/*!
+ * Accounts for the emission of \a record, which stands for \a count deliveries
+ * of its signal. The latency is measured from the handler's timestamp to now.
+ */
+void UnixSignalCorePrivate::updateStatistics(const UnixSignalInfo &record, int count)
+{
+    SignalState &state = signalStates[record.signal];
+    state.delivered.fetch_add(1, std::memory_order_relaxed);
+    state.coalesced.fetch_add(count - 1, std::memory_order_relaxed);
+    ++state.queueDepth;
+
+    // Records recovered by the overflow sweep carry no timestamp
+    if (record.timestamp == 0)
+        return;
+
+    const qint64 latency = monotonicNanoseconds() - record.timestamp;
+    state.totalLatency.fetch_add(latency, std::memory_order_relaxed);
+    if (latency > state.maxLatency.load(std::memory_order_relaxed))
+        state.maxLatency.store(latency, std::memory_order_relaxed);
+    if (LatencyBuckets *buckets = state.latency.load(std::memory_order_relaxed)) {
+        const int bucket = UnixSignalLatencyHistogram::bucketOf(latency);
+        if (bucket < UnixSignalLatencyHistogram::BucketCount)
+            buckets->counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        else
+            buckets->overflow.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/*!
+ * Returns a snapshot of the statistics for \a signal. Safe to call from any
+ * thread; the counters are read individually, so a snapshot taken while
+ * signals are being drained may be off by the records of the current wakeup.
+ */
+UnixSignalStatistics UnixSignalCorePrivate::statistics(int signal) const
+{
+    UnixSignalStatistics stats = UnixSignalStatistics();
+    if (signal <= 0 || signal >= NSIG)
+        return stats;
+
+    const SignalState &state = signalStates[signal];
+    stats.delivered = state.delivered.load(std::memory_order_relaxed);
+    stats.coalesced = state.coalesced.load(std::memory_order_relaxed);
+    stats.dropped = state.dropped.load(std::memory_order_relaxed);
+    stats.maxQueueDepth = state.maxQueueDepth.load(std::memory_order_relaxed);
+    stats.totalLatency = state.totalLatency.load(std::memory_order_relaxed);
+    stats.maxLatency = state.maxLatency.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/*!
+ * Returns a snapshot of the latency histogram of \a signal, with the same
+ * caveat as statistics().
+ */
+UnixSignalLatencyHistogram UnixSignalCorePrivate::latencyHistogram(int signal) const
+{
+    UnixSignalLatencyHistogram histogram = UnixSignalLatencyHistogram();
+    if (signal <= 0 || signal >= NSIG)
+        return histogram;
+
+    const LatencyBuckets *buckets = signalStates[signal].latency.load();
+    if (!buckets)
+        return histogram;
+
+    histogram.counts.resize(UnixSignalLatencyHistogram::BucketCount);
+    for (int i = 0; i < UnixSignalLatencyHistogram::BucketCount; ++i)
+        histogram.counts[i] = buckets->counts[i].load(std::memory_order_relaxed);
+    histogram.overflow = buckets->overflow.load(std::memory_order_relaxed);
+    return histogram;
+}
+
+/*!
+ * Passes to \a dropped each watched signal that lost records since the last
+ * report, with the number of records lost.
+ */
+void UnixSignalCorePrivate::reportDroppedSignals(const UnixSignalCore::DroppedCallback &dropped)
+{
+    for (int i = 0; i < watchedSignals.count(); ++i) {
+        const int signal = watchedSignals.at(i);
+        SignalState &state = signalStates[signal];
+        const quint32 lost = state.dropped.load();
+        if (lost == state.droppedReported)
+            continue;
+
+        const int count = int(lost - state.droppedReported);
+        state.droppedReported = lost;
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: signal queue full," << count
+                              << "deliveries of" << UnixSignalCore::signalName(signal)
+                              << "were dropped";
+        if (dropped)
+            dropped(signal, count);
+    }
+}
+
+/*!
+ * Moves every record in the queues to pendingSignals, the high-priority ones
+ * first. The doorbell is re-armed first so that a signal queued from now on
+ * rings it again.
+ */
+void UnixSignalCorePrivate::drainQueue()
+{
+    doorbell.clear();
+    doorbellRung.store(false);
+
+    UnixSignalInfo record;
+    while (priorityQueue.pop(&record))
+        pendingSignals.append(record);
+    while (queue.pop(&record))
+        pendingSignals.append(record);
+}
+
+/*!
+ * Returns true if a signal may be parked in the calling thread, i.e. left
+ * blocked there until drain() takes it back. Only a thread that resumes the
+ * signal itself may be parked: the signal thread, or with the signal handler
+ * the thread which drains this core. Other threads keep taking the signal
+ * into what is left of the queue. Async-signal-safe.
+ */
+bool UnixSignalCorePrivate::mayParkSignals() const
+{
+#if defined(SIGWATCH_HAVE_SIGWAIT)
+    return true;
+#elif defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD)
+    return ::pthread_equal(drainThread.load(), ::pthread_self());
+#else
+    return false;
+#endif
+}
+
+/*!
+ * Takes back from the kernel the signals left pending by notify() once the
+ * queues have been emptied.
+ */
+void UnixSignalCorePrivate::resumeParkedSignals()
+{
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD)
+    if (!signalsParked.exchange(false))
+        return;
+
+    // Signals unwatched since they were parked are taken back too
+    sigset_t parked;
+    ::sigemptyset(&parked);
+    for (int signal = 1; signal < NSIG; ++signal) {
+        if (signalStates[signal].parked.exchange(false))
+            ::sigaddset(&parked, signal);
+    }
+    resumeSignals(parked);
+#endif
+}
+
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD)
+/*!
+ * Resumes the \a parked signals. With the signal handler they are unblocked
+ * in the calling thread, the draining thread they were parked in, which
+ * receives those still pending right away. The signal thread is told to wait
+ * for them again instead.
+ */
+void UnixSignalCorePrivate::resumeSignals(const sigset_t &parked)
+{
+#if defined(SIGWATCH_HAVE_SIGWAIT)
+    // The signal thread reloads its whole set, the parked signals with it
+    Q_UNUSED(parked);
+    wakeSignalWaiter();
+#else
+    int error = ::pthread_sigmask(SIG_UNBLOCK, &parked, NULL);
+    if (error)
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: pthread_sigmask: " << ::strerror(error);
+#endif
+}
+#endif
+
+/*!
+ * Passes \a record to \a callback unless its signal was unwatched since it was
+ * queued, or its coalesced deliveries were already collected. Returns the
+ * number of records passed, 0 or 1.
+ *
+ * A record caught before its signal was last watched is left from an earlier
+ * watch, even if the signal was watched again before the record was drained.
+ * Coalesced signals need no such check: unwatching them zeroes their pending
+ * count, which the record of a new delivery is matched against.
+ */
+int UnixSignalCorePrivate::passRecord(const UnixSignalInfo &record,
+                                      const UnixSignalCore::Callback &callback)
+{
+    const int signal = record.signal;
+    if (!isWatched(signal))
+        return 0;   // Unwatched since it was queued
+
+    SignalState &state = signalStates[signal];
+    int count = 1;
+    if (isCoalesced(signal)) {
+        count = state.pending.exchange(0);
+        if (count == 0)
+            return 0;
+    } else if (record.timestamp < state.watchedSince) {
+        return 0;   // Unwatched and watched again since it was queued
+    }
+
+    updateStatistics(record, count);
+    if (callback)
+        callback(record, count);
+
+#ifdef Q_OS_WIN
+    // Lets a console close or shutdown go on, its handler is waiting for this
+    if (signal == SIGTERM && consoleClosed.exchange(false))
+        ::SetEvent(consoleDrained);
+#endif
+    return 1;
+}
+
+/*!
+ * Passes the high-priority records queued since drainQueue() to \a callback,
+ * so that they do not wait for the rest of a large drain. Returns the number
+ * of records passed.
+ */
+int UnixSignalCorePrivate::passPrioritySignals(const UnixSignalCore::Callback &callback)
+{
+    int passed = 0;
+    UnixSignalInfo record;
+    while (priorityQueue.pop(&record))
+        passed += passRecord(record, callback);
+    return passed;
+}
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+/*!
+ * Reads all pending signals from the shared signalfd in as few \c read() calls
+ * as possible and forwards them to the interested cores.
+ */
+void UnixSignalCorePrivate::readSignalFd()
+{
+    struct signalfd_siginfo buffer[16];
+    const int capacity = sizeof(buffer) / sizeof(buffer[0]);
+
+    // Another core may have emptied the signalfd first
+    for (;;) {
+        ssize_t nBytes = ::read(signalFd, buffer, sizeof(buffer));
+        if (nBytes < 0 && errno == EINTR)
+            continue;
+        if (nBytes <= 0)
+            break;
+
+        const int count = nBytes / sizeof(buffer[0]);
+        const qint64 now = monotonicNanoseconds();
+        for (int i = 0; i < count; ++i) {
+            UnixSignalInfo record;
+            record.signal = buffer[i].ssi_signo;
+            record.timestamp = now;
+            record.code = buffer[i].ssi_code;
+            record.pid = buffer[i].ssi_pid;
+            record.uid = buffer[i].ssi_uid;
+            record.status = buffer[i].ssi_status;
+            record.value = buffer[i].ssi_int;
+            record.pointer = quintptr(buffer[i].ssi_ptr);
+            record.programCounter = 0;
+            deliverSignal(record, this);
+        }
+
+        if (count < capacity)
+            break;
+    }
+}
+#endif // SIGWATCH_HAVE_SIGNALFD
+
+/*!
+ * Collects every signal caught since the last call and passes each record to
+ * \a callback, in order, with the number of deliveries it stands for, then
+ * reports lost records to \a dropped. Returns the number of records passed.
+ *
+ * A coalesced signal appears once; its pending count is collected here, and
+ * its record is that of the delivery which woke up the core. Records of a
+ * signal unwatched since they were queued are skipped, which keeps this safe
+ * when \a callback unwatches signals.
+ */
+int UnixSignalCorePrivate::drain(const UnixSignalCore::Callback &callback,
+                                 const UnixSignalCore::DroppedCallback &dropped)
+{
+    pendingSignals.resize(0);
+#if defined(Q_OS_UNIX) && !defined(SIGWATCH_HAVE_SIGNALFD) && !defined(SIGWATCH_HAVE_SIGWAIT)
+    drainThread.store(::pthread_self());
+#endif
+
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    readSignalFd();
+#endif
+    drainQueue();
+    resumeParkedSignals();
+
+    // A coalesced signal whose record could not be queued is still counted,
+    // the records of other signals are lost and reported after the others
+    const bool overflowed = queueOverflowed.exchange(false);
+    if (overflowed) {
+        for (int i = 0; i < watchedSignals.count(); ++i) {
+            const int signal = watchedSignals.at(i);
+            if (!isCoalesced(signal) || signalStates[signal].pending.load() == 0)
+                continue;
+
+            bool queued = false;
+            for (int j = 0; j < pendingSignals.count() && !queued; ++j)
+                queued = pendingSignals.at(j).signal == signal;
+            if (!queued) {
+                UnixSignalInfo record = UnixSignalInfo();
+                record.signal = signal;
+                pendingSignals.append(record);
+            }
+        }
+    }
+
+    // High-priority records read from the signalfd or recovered by the
+    // sweep go before the others too
+    std::stable_partition(pendingSignals.begin(), pendingSignals.end(),
+                          [this](const UnixSignalInfo &record) {
+                              return isHighPriority(record.signal);
+                          });
+
+    // The callback may watch or unwatch signals, so work on a copy. One
+    // arriving while the others are passed overtakes those left.
+    const QVector<UnixSignalInfo> records = pendingSignals;
+    int passed = 0;
+    for (int i = 0; i < records.count(); ++i) {
+        const UnixSignalInfo &record = records.at(i);
+        if (!isHighPriority(record.signal))
+            passed += passPrioritySignals(callback);
+        passed += passRecord(record, callback);
+    }
+
+    // Fold the number of records drained for each signal into its maximum
+    for (int i = 0; i < watchedSignals.count(); ++i) {
+        SignalState &state = signalStates[watchedSignals.at(i)];
+        if (state.queueDepth > state.maxQueueDepth.load(std::memory_order_relaxed))
+            state.maxQueueDepth.store(state.queueDepth, std::memory_order_relaxed);
+        state.queueDepth = 0;
+    }
+
+    if (overflowed)
+        reportDroppedSignals(dropped);
+    return passed;
+}
+
+
+/*!
+ * Create a new core. Check isValid() before use: the process-wide table holds
+ * at most 32 cores and watchers together.
+ */
+UnixSignalCore::UnixSignalCore() :
+    d_ptr(new UnixSignalCorePrivate)
+{
+}
+
+/*!
+ * Destroy this core, unwatching every signal it watches.
+ */
+UnixSignalCore::~UnixSignalCore()
+{
+    delete d_ptr;
+}
+
+/*!
+ * Returns true if the core could set up its wakeup descriptor and register
+ * itself.
+ */
+bool UnixSignalCore::isValid() const
+{
+    Q_D(const UnixSignalCore);
+    return d->valid;
+}
+
+/*!
+ * Watches \a signal with \a options, a combination of WatchOption values.
+ * Calling this again for a signal that is already watched updates its
+ * options. Returns false if the signal could not be watched.
+ */
+bool UnixSignalCore::watchSignal(int signal, int options)
+{
+    Q_D(UnixSignalCore);
+    return d->watchSignal(signal, options);
+}
+
+/*!
+ * Watches the \a count signals in \a signalList with the same \a options,
+ * installing them together so that none of them can arrive while only some
+ * are caught.
+ */
+void UnixSignalCore::watchSignals(const int *signalList, int count, int options)
+{
+    Q_D(UnixSignalCore);
+    d->watchSignals(signalList, count, options);
+}
+
+/*!
+ * Stops watching \a signal. Once no core is left for it, its previous
+ * disposition is restored.
+ */
+void UnixSignalCore::unwatchSignal(int signal)
+{
+    Q_D(UnixSignalCore);
+    d->unwatchSignal(signal);
+}
+
+/*!
+ * Returns true if this core watches \a signal. Constant time.
+ */
+bool UnixSignalCore::isWatched(int signal) const
+{
+    Q_D(const UnixSignalCore);
+    return signal > 0 && signal < NSIG && d->isWatched(signal);
+}
+
+/*!
+ * Returns the options \a signal is watched with, or 0 if it is not watched.
+ */
+int UnixSignalCore::watchOptions(int signal) const
+{
+    Q_D(const UnixSignalCore);
+    if (!isWatched(signal))
+        return 0;
+    return d->signalStates[signal].options.load() & ~int(UnixSignalCorePrivate::WatchedFlag);
+}
+
+/*!
+ * Returns the watched signals, in the order they were first watched.
+ */
+QVector<int> UnixSignalCore::watchedSignals() const
+{
+    Q_D(const UnixSignalCore);
+    return d->watchedSignals;
+}
+
+#if defined(Q_OS_WIN)
+/*!
+ * Returns the event \c HANDLE which is signalled when drain() has signals to
+ * collect. It is an auto-reset event.
+ */
+void *UnixSignalCore::event() const
+{
+    Q_D(const UnixSignalCore);
+    return d->doorbell.event;
+}
+#else
+/*!
+ * Returns the descriptor which becomes readable when drain() has signals to
+ * collect, or -1 if the core is not valid. Wait for it in any event loop;
+ * only drain() reads from it. It is level-triggered: it stays readable until
+ * drained.
+ *
+ * With the signalfd back-end it is an \c epoll(7) descriptor, which can
+ * itself be added to another epoll set or polled.
+ */
+int UnixSignalCore::fd() const
+{
+    Q_D(const UnixSignalCore);
+    if (!d->valid)
+        return -1;
+#ifdef SIGWATCH_HAVE_SIGNALFD
+    return d->epollFd;
+#else
+    return d->doorbell.readFd;
+#endif
+}
+#endif
+
+/*!
+ * Collects every signal caught since the last call, without blocking, and
+ * calls \a callback for each, in order, with the record of the delivery and
+ * the number of deliveries it stands for, which is only greater than one for
+ * coalesced signals. Then calls \a dropped for each signal that lost records
+ * to a full queue. Returns the number of records passed to \a callback.
+ *
+ * Call this from the event loop when fd() is readable. The callbacks run in
+ * the calling thread and may watch or unwatch signals.
+ */
+int UnixSignalCore::drain(const Callback &callback, const DroppedCallback &dropped)
+{
+    Q_D(UnixSignalCore);
+    return d->drain(callback, dropped);
+}
+
+/*!
+ * Returns a snapshot of the delivery statistics for \a signal since it was
+ * first watched. Safe to call from any thread.
+ */
+UnixSignalStatistics UnixSignalCore::statistics(int signal) const
+{
+    Q_D(const UnixSignalCore);
+    return d->statistics(signal);
+}
+
+/*!
+ * Returns a snapshot of the latencies of \a signal since it was first
+ * watched, the same ones summed in statistics(). Safe to call from any thread.
+ */
+UnixSignalLatencyHistogram UnixSignalCore::latencyHistogram(int signal) const
+{
+    Q_D(const UnixSignalCore);
+    return d->latencyHistogram(signal);
+}
+
+/*!
+ * Returns the statistics and latency histograms of every watched signal in
+ * the Prometheus text exposition format, to be served as \c text/plain on a
+ * metrics endpoint. Each series is labelled with the signal number and name.
+ *
+ * The latency histogram, \c sigwatch_signal_latency_seconds, has a bucket per
+ * power of two nanoseconds from about 1 us to 68 s, coarser than
+ * latencyHistogram() so that the set of series stays small. Latencies beyond
+ * the last bucket are only counted under \c +Inf.
+ */
+QByteArray UnixSignalCore::prometheusMetrics() const
+{
+    Q_D(const UnixSignalCore);
+
+    static const struct {
+        const char *name;
+        const char *help;
+    } counters[] = {
+        { "sigwatch_signals_delivered_total", "Deliveries passed on by a drain." },
+        { "sigwatch_signals_coalesced_total", "Deliveries folded into an earlier one." },
+        { "sigwatch_signals_dropped_total", "Deliveries lost to a full queue." }
+    };
+    static const char latencyName[] = "sigwatch_signal_latency_seconds";
+
+    QVector<QByteArray> labels;
+    QVector<UnixSignalStatistics> stats;
+    for (int i = 0; i < d->watchedSignals.count(); ++i) {
+        const int signal = d->watchedSignals.at(i);
+        labels.append(QByteArray("signal=\"") + QByteArray::number(signal) + "\",name=\""
+                      + signalName(signal) + "\"");
+        stats.append(d->statistics(signal));
+    }
+
+    QByteArray text;
+    for (int c = 0; c < 3; ++c) {
+        text += QByteArray("# HELP ") + counters[c].name + ' ' + counters[c].help + '\n';
+        text += QByteArray("# TYPE ") + counters[c].name + " counter\n";
+        for (int i = 0; i < labels.count(); ++i) {
+            const quint64 value = c == 0 ? stats.at(i).delivered
+                                : c == 1 ? stats.at(i).coalesced : stats.at(i).dropped;
+            text += QByteArray(counters[c].name) + '{' + labels.at(i) + "} "
+                    + QByteArray::number(value) + '\n';
+        }
+    }
+
+    text += QByteArray("# HELP ") + latencyName
+            + " Time from catching a signal to passing it on.\n";
+    text += QByteArray("# TYPE ") + latencyName + " histogram\n";
+    for (int i = 0; i < labels.count(); ++i) {
+        const UnixSignalLatencyHistogram histogram = d->latencyHistogram(d->watchedSignals.at(i));
+        quint64 cumulative = 0;
+        int bucket = 0;
+
+        // The powers of two from 2^10 ns fall on bucket boundaries
+        for (int exponent = 10; exponent <= 36; ++exponent) {
+            const qint64 bound = Q_INT64_C(1) << exponent;
+            for (; bucket < histogram.counts.count()
+                   && UnixSignalLatencyHistogram::upperBound(bucket) <= bound; ++bucket)
+                cumulative += histogram.counts.at(bucket);
+            text += QByteArray(latencyName) + "_bucket{" + labels.at(i) + ",le=\""
+                    + QByteArray::number(bound / 1e9, 'g', 12) + "\"} "
+                    + QByteArray::number(cumulative) + '\n';
+        }
+        const quint64 count = histogram.count();
+        text += QByteArray(latencyName) + "_bucket{" + labels.at(i) + ",le=\"+Inf\"} "
+                + QByteArray::number(count) + '\n';
+        text += QByteArray(latencyName) + "_sum{" + labels.at(i) + "} "
+                + QByteArray::number(stats.at(i).totalLatency / 1e9, 'g', 9) + '\n';
+        text += QByteArray(latencyName) + "_count{" + labels.at(i) + "} "
+                + QByteArray::number(count) + '\n';
+    }
+    return text;
+}
+
+/*!
+ * Returns a human readable description of \a signal. The descriptions are
+ * looked up in a table built once, so this is cheap and never allocates.
+ */
+const char *UnixSignalCore::signalName(int signal)
+{
+    static const SignalNameTable table;
+
+    if (signal <= 0 || signal >= NSIG)
+        return "Unknown signal";
+    return table.names[signal];
+}
+
+
+/*!
+ * Sets the \a callback called in the child after \c fork(), once this core has
+ * been re-armed or disabled according to forkPolicy(). It runs in the thread
+ * which called \c fork(), before \c fork() returns, and lets an adapter
+ * replace descriptors of its own which the child shares with the parent.
+ */
+void UnixSignalCore::setForkCallback(const ForkCallback &callback)
+{
+    Q_D(UnixSignalCore);
+    d->forkCallback = callback;
+}
+
+/*!
+ * Sets what the cores do in the child after \c fork(), for the whole process.
+ *
+ * With RearmInChild, the default, each core keeps watching the same signals
+ * through private descriptors under the same numbers, so a child of a
+ * pre-forking server needs no new core. With DisableInChild, every core stops
+ * watching and the signals get their previous dispositions back.
+ *
+ * Not on Windows, which has no \c fork().
+ */
+void UnixSignalCore::setForkPolicy(ForkPolicy policy)
+{
+    UnixSignalCorePrivate::forkPolicy.store(policy);
+}
+
+/*!
+ * Returns what the cores do in the child after \c fork().
+ */
+UnixSignalCore::ForkPolicy UnixSignalCore::forkPolicy()
+{
+    return ForkPolicy(UnixSignalCorePrivate::forkPolicy.load());
+}
+
+/*!
+ * Blocks, or unblocks if \a block is false, every signal watched so far by any
+ * core in the calling thread. Returns false if the signal mask could not be
+ * changed, or on systems without signal masks. With the signalfd and sigwait
+ * back-ends the watched signals must remain blocked everywhere, so unblocking
+ * them does nothing and returns false.
+ */
+bool UnixSignalCore::maskWatchedSignals(bool block)
+{
+#if defined(SIGWATCH_HAVE_SIGNALFD) || defined(SIGWATCH_HAVE_SIGWAIT)
+    if (!block) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: watched signals must stay blocked with this back-end";
+        return false;
+    }
+#endif
+    return UnixSignalCorePrivate::maskWatchedSignals(block);
+}
+
+/*!
+ * Returns the number of records counted in the histogram, the overflow
+ * included.
+ */
+quint64 UnixSignalLatencyHistogram::count() const
+{
+    quint64 total = overflow;
+    for (int i = 0; i < counts.count(); ++i)
+        total += counts.at(i);
+    return total;
+}
+
+/*!
+ * Returns the latency in nanoseconds which \a fraction, between 0 and 1, of
+ * the records did not exceed, e.g. 0.99 for the 99th percentile. This is the
+ * highest value of the bucket it falls in, or 0 if the histogram is empty. A
+ * percentile among the overflow is reported as the end of the last bucket,
+ * which it exceeds.
+ */
+qint64 UnixSignalLatencyHistogram::percentile(double fraction) const
+{
+    const quint64 total = count();
+    if (total == 0)
+        return 0;
+
+    const quint64 rank = qMax(quint64(1), quint64(fraction * total + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < counts.count(); ++i) {
+        seen += counts.at(i);
+        if (seen >= rank)
+            return upperBound(i) - 1;
+    }
+    return upperBound(BucketCount - 1);
+}
+
+/*!
+ * Returns the bucket of \a latency, in nanoseconds, or \c BucketCount if it
+ * is beyond the last bucket.
+ */
+int UnixSignalLatencyHistogram::bucketOf(qint64 latency)
+{
+    const int subBuckets = 1 << SubBucketBits;
+    if (latency < subBuckets)
+        return latency < 0 ? 0 : int(latency);
+
+    int exponent = SubBucketBits;
+    while (exponent < 62 && (latency >> (exponent + 1)))
+        ++exponent;
+    const int bucket = (exponent - SubBucketBits + 1) * subBuckets
+            + int((latency >> (exponent - SubBucketBits)) & (subBuckets - 1));
+    return qMin(bucket, int(BucketCount));
+}
+
+/*!
+ * Returns the lowest latency, in nanoseconds, of \a bucket.
+ */
+qint64 UnixSignalLatencyHistogram::lowerBound(int bucket)
+{
+    const int subBuckets = 1 << SubBucketBits;
+    if (bucket < subBuckets)
+        return bucket;
+
+    const int exponent = bucket / subBuckets + SubBucketBits - 1;
+    return qint64(subBuckets + bucket % subBuckets) << (exponent - SubBucketBits);
+}
+
+/*!
+ * Returns the latency, in nanoseconds, above the values of \a bucket.
+ */
+qint64 UnixSignalLatencyHistogram::upperBound(int bucket)
+{
+    return lowerBound(bucket + 1);
+}
+
+/*!
+ * \enum UnixSignalCore::WatchOption
+ * The same options as UnixSignalWatcher::WatchOption.
+ */
+
+/*!
+ * \enum UnixSignalCore::ForkPolicy
+ * The same policies as UnixSignalWatcher::ForkPolicy.
+ */
@@ -0,0 +1,180 @@
+/*
+ * Async-signal-safe core of the Unix signal watcher.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGCORE_H
+#define SIGCORE_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QVector>
+#include <functional>
+#include <signal.h>
+
+class UnixSignalCorePrivate;
+
+
+/*!
+ * \brief The UnixSignalInfo struct describes one received Unix signal.
+ *
+ * The \c timestamp is taken in the signal handler, or when the signal is read
+ * with the signalfd back-end. The other fields are copied from the
+ * \c siginfo_t passed to the handler; which of them are meaningful depends on
+ * \c code, see \c sigaction(2). The \c programCounter is read from the
+ * interrupted context where the platform allows it, and is 0 with the signalfd
+ * and sigwait back-ends, which interrupt nothing. On Windows only \c signal and
+ * \c timestamp are set.
+ */
+struct UnixSignalInfo
+{
+    int signal;         // si_signo
+    qint64 timestamp;   // CLOCK_MONOTONIC nanoseconds when caught
+    int code;           // si_code
+    qint64 pid;         // si_pid: sending process, or child for SIGCHLD
+    uint uid;           // si_uid: real user ID of the sending process
+    int status;         // si_status: exit status or signal for SIGCHLD
+    int value;          // si_value.sival_int, as passed to sigqueue()
+    quintptr pointer;   // si_value.sival_ptr
+    quintptr programCounter;    // interrupted instruction, handler back-end only
+};
+Q_DECLARE_TYPEINFO(UnixSignalInfo, Q_PRIMITIVE_TYPE);
+
+
+/*!
+ * \brief The UnixSignalStatistics struct is a snapshot of the deliveries of one
+ * signal to one UnixSignalWatcher or UnixSignalCore.
+ *
+ * Every caught delivery is counted exactly once as delivered, coalesced or
+ * dropped. Latencies are in nanoseconds, from the signal handler (or signalfd
+ * read) to the drain which passes the delivery on, e.g. as Qt signals.
+ */
+struct UnixSignalStatistics
+{
+    quint64 delivered;      // deliveries passed on by a drain
+    quint64 coalesced;      // deliveries folded into an earlier one
+    quint64 dropped;        // deliveries lost to a full queue
+    int maxQueueDepth;      // most records of the signal drained in one wakeup
+    qint64 totalLatency;    // summed over the delivered records
+    qint64 maxLatency;
+};
+
+
+/*!
+ * \brief The UnixSignalLatencyHistogram struct is a snapshot of the latencies
+ * of one signal, as counted in UnixSignalStatistics, bucketed log-linearly.
+ *
+ * Latencies below 16 ns each have a bucket; above, every power of two is split
+ * into 8 buckets, so a bucket is within 12.5% of its values, up to about 68 s.
+ * Longer latencies are only counted in \c overflow. Records without a
+ * timestamp, those recovered after a full queue, are not counted.
+ */
+struct UnixSignalLatencyHistogram
+{
+    enum { SubBucketBits = 3, BucketCount = 272 };
+
+    QVector<quint64> counts;    // records per bucket, empty if none
+    quint64 overflow;           // records beyond the last bucket
+
+    quint64 count() const;
+    qint64 percentile(double fraction) const;
+
+    static int bucketOf(qint64 latency);
+    static qint64 lowerBound(int bucket);
+    static qint64 upperBound(int bucket);   // exclusive
+};
+
+
+/*!
+ * \brief The UnixSignalCore class catches Unix signals and hands them to any
+ * event loop.
+ *
+ * This is the part of UnixSignalWatcher which does not depend on a Qt event
+ * loop: the signal handler, or the signalfd or sigwait back-end, the lock-free
+ * queue and the wakeup descriptor. Watch signals with watchSignal(), wait for
+ * fd() to become readable in the event loop of your choice, and call drain()
+ * to receive every signal caught since the previous call. Only QtCore is
+ * needed, not a running QCoreApplication.
+ *
+ * UnixSignalWatcher is its adapter to the Qt event loop; \c sigwatchasio.h
+ * and \c sigwatchepoll.h provide adapters to Boost.Asio and to a raw
+ * \c epoll(7) loop. A core is not thread-safe: watch, unwatch and drain from
+ * one thread at a time.
+ */
+class UnixSignalCore
+{
+    Q_DECLARE_PRIVATE(UnixSignalCore)
+
+public:
+    enum WatchOption {
+        NoWatchOptions  = 0x0,
+        CoalesceSignals = 0x1,
+        SignalInfo      = 0x2,
+        QueueSignals    = 0x4,
+        HighPriority    = 0x8
+    };
+
+    enum ForkPolicy {
+        RearmInChild,
+        DisableInChild
+    };
+
+    typedef std::function<void(const UnixSignalInfo &info, int count)> Callback;
+    typedef std::function<void(int signal, int count)> DroppedCallback;
+    typedef std::function<void()> ForkCallback;
+
+    UnixSignalCore();
+    ~UnixSignalCore();
+
+    bool isValid() const;
+
+    bool watchSignal(int signal, int options = NoWatchOptions);
+    void watchSignals(const int *signalList, int count, int options = NoWatchOptions);
+    void unwatchSignal(int signal);
+    bool isWatched(int signal) const;
+    int watchOptions(int signal) const;
+    QVector<int> watchedSignals() const;
+
+#if defined(Q_OS_WIN)
+    void *event() const;
+#else
+    int fd() const;
+#endif
+    int drain(const Callback &callback, const DroppedCallback &dropped = DroppedCallback());
+
+    UnixSignalStatistics statistics(int signal) const;
+    UnixSignalLatencyHistogram latencyHistogram(int signal) const;
+    QByteArray prometheusMetrics() const;
+
+    void setForkCallback(const ForkCallback &callback);
+    static void setForkPolicy(ForkPolicy policy);
+    static ForkPolicy forkPolicy();
+
+    static const char *signalName(int signal);
+    static bool maskWatchedSignals(bool block);
+
+private:
+    Q_DISABLE_COPY(UnixSignalCore)
+    UnixSignalCorePrivate * const d_ptr;
+};
+
+#endif // SIGCORE_H
@@ -0,0 +1,17 @@
+# Event-loop-agnostic UnixSignalCore, with header-only adapters for Boost.Asio
+# and epoll(7). Needs QtCore only, and no moc.
+SOURCES += $$PWD/sigcore.cpp
+
+HEADERS += $$PWD/sigcore.h
+
+unix: HEADERS += $$PWD/sigwatchasio.h
+linux: HEADERS += $$PWD/sigwatchepoll.h
+
+CONFIG += c++11
+
+# Read signals from a signalfd(2) instead of a signal handler (Linux only).
+linux:sigwatch_signalfd: DEFINES += SIGWATCH_SIGNALFD
+
+# Collect signals with sigtimedwait(2) on an internal thread instead of a signal
+# handler, so that no thread is interrupted by them (not on macOS).
+unix:!macx:sigwatch_sigwait: DEFINES += SIGWATCH_SIGWAIT
@@ -0,0 +1,358 @@
+/*
+ * Child process reaping on SIGCHLD for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sigreap.h"
+#include "sigwatch.h"
+#include <QDebug>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(Q_OS_LINUX)
+#include <sys/syscall.h>
+#if defined(SYS_pidfd_open) && !defined(SIGWATCH_NO_PIDFD)
+#define SIGWATCH_HAVE_PIDFD
+#endif
+#endif
+
+Q_DECLARE_LOGGING_CATEGORY(lcSigwatch)
+
+/*!
+ * \brief The UnixChildReaperPrivate class keeps the registered children of a
+ * UnixChildReaper and collects them.
+ *
+ * Exited children are found with \c waitid(WNOWAIT), which tells which child
+ * exited without reaping it, so each exit costs O(1) regardless of the number
+ * of children being watched. Only when an exited child that is not ours is in
+ * the way are the registered children polled one by one.
+ *
+ * On Linux 5.3 and later, each registered child is instead watched through a
+ * pidfd, which becomes readable when the child exits, and \c SIGCHLD is not
+ * watched at all unless every child is to be reaped or a pidfd could not be
+ * opened. Older kernels fall back to \c SIGCHLD.
+ */
+class UnixChildReaperPrivate
+{
+    UnixChildReaper * const q_ptr;
+    Q_DECLARE_PUBLIC(UnixChildReaper)
+
+public:
+    UnixChildReaperPrivate(UnixChildReaper *q, UnixSignalWatcher *watcher);
+
+    struct Child
+    {
+        Child() : notifier(0) {}
+
+        UnixChildReaper::Callback callback;
+        QSocketNotifier *notifier;  // on the pidfd, if any
+    };
+
+    static bool havePidfd();
+    bool watchPidfd(qint64 pid, Child &child);
+    void watchSigChild();
+
+    bool reapChild(qint64 pid);
+    void reapRegistered();
+    void finish(qint64 pid, int status);
+
+    void _q_onSignal(int signal);
+
+    UnixSignalWatcher *watcher;
+    QHash<qint64, Child> children;
+    bool reapAll;
+    bool sigChildWatched;
+};
+
+UnixChildReaperPrivate::UnixChildReaperPrivate(UnixChildReaper *q, UnixSignalWatcher *watcher) :
+    q_ptr(q),
+    watcher(watcher),
+    reapAll(false),
+    sigChildWatched(false)
+{
+}
+
+/*!
+ * Returns true if the kernel supports \c pidfd_open(2). Probed once.
+ */
+bool UnixChildReaperPrivate::havePidfd()
+{
+#if defined(SIGWATCH_HAVE_PIDFD)
+    static const bool supported = [] {
+        const int fd = int(::syscall(SYS_pidfd_open, ::getpid(), 0));
+        if (fd < 0)
+            return false;
+        ::close(fd);
+        return true;
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * Watches the exit of \a pid through a pidfd, returning false with \c errno set
+ * if none could be opened: \c ESRCH if \a pid has already been reaped.
+ */
+bool UnixChildReaperPrivate::watchPidfd(qint64 pid, Child &child)
+{
+#if defined(SIGWATCH_HAVE_PIDFD)
+    Q_Q(UnixChildReaper);
+
+    const int fd = int(::syscall(SYS_pidfd_open, pid_t(pid), 0));
+    if (fd < 0)
+        return false;   // pidfds are close-on-exec already
+
+    child.notifier = new QSocketNotifier(fd, QSocketNotifier::Read, q);
+    QObject::connect(child.notifier, &QSocketNotifier::activated, q, [this, pid]() { reapChild(pid); });
+    child.notifier->setEnabled(true);
+    return true;
+#else
+    Q_UNUSED(pid);
+    Q_UNUSED(child);
+    return false;
+#endif
+}
+
+/*!
+ * Starts reaping on \c SIGCHLD, coalesced, unless already done.
+ */
+void UnixChildReaperPrivate::watchSigChild()
+{
+    Q_Q(UnixChildReaper);
+
+    if (sigChildWatched)
+        return;
+    sigChildWatched = true;
+    watcher->watchForSignal(SIGCHLD, UnixSignalWatcher::CoalesceSignals);
+    QObject::connect(watcher, SIGNAL(unixSignal(int)), q, SLOT(_q_onSignal(int)));
+
+    // Children may have exited unnoticed before now
+    q->reap();
+}
+
+/*!
+ * Reaps \a pid if it has exited, returning true if it has.
+ */
+bool UnixChildReaperPrivate::reapChild(qint64 pid)
+{
+    int status;
+    pid_t result;
+    do {
+        result = ::waitpid(pid_t(pid), &status, WNOHANG);
+    } while (result < 0 && errno == EINTR);
+
+    if (result == 0)
+        return false;
+    if (result < 0) {
+        // Reaped by someone else; its status is lost
+        qCWarning(lcSigwatch) << "UnixChildReaper: waitpid" << pid << ": " << ::strerror(errno);
+        status = -1;
+    }
+    finish(pid, status);
+    return true;
+}
+
+/*!
+ * Polls every registered child. Only used when an exited child which is not
+ * ours hides the others from \c waitid().
+ */
+void UnixChildReaperPrivate::reapRegistered()
+{
+    const QList<qint64> pids = children.keys();
+    for (int i = 0; i < pids.count(); ++i)
+        reapChild(pids.at(i));
+}
+
+/*!
+ * Reports the exit of \a pid with the \c waitpid() \a status to its callback,
+ * which is forgotten first so that it may register new children.
+ */
+void UnixChildReaperPrivate::finish(qint64 pid, int status)
+{
+    Q_Q(UnixChildReaper);
+
+    const Child child = children.take(pid);
+    if (child.notifier) {
+        // Possibly called from the notifier itself, so it is deleted later
+        child.notifier->setEnabled(false);
+        ::close(int(child.notifier->socket()));
+        child.notifier->deleteLater();
+    }
+
+    qCDebug(lcSigwatch) << "Reaped child" << pid << "with status" << status;
+    if (child.callback)
+        child.callback(pid, status);
+    emit q->childExited(pid, status);
+}
+
+void UnixChildReaperPrivate::_q_onSignal(int signal)
+{
+    Q_Q(UnixChildReaper);
+    if (signal == SIGCHLD)
+        q->reap();
+}
+
+
+/*!
+ * Create a new reaper as a child of the given \a parent, which collects
+ * children when \a watcher catches \c SIGCHLD. The watcher is told to watch
+ * for \c SIGCHLD, coalesced, unless pidfds are supported.
+ */
+UnixChildReaper::UnixChildReaper(UnixSignalWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    d_ptr(new UnixChildReaperPrivate(this, watcher))
+{
+    Q_D(UnixChildReaper);
+    if (!d->havePidfd())
+        d->watchSigChild();
+}
+
+UnixChildReaper::~UnixChildReaper()
+{
+    Q_D(UnixChildReaper);
+    const QList<qint64> pids = d->children.keys();
+    for (int i = 0; i < pids.count(); ++i) {
+        // Delete each notifier before closing its pidfd, or it would watch a
+        // descriptor the process may since have reused
+        QSocketNotifier *notifier = d->children.value(pids.at(i)).notifier;
+        if (!notifier)
+            continue;
+        const int fd = int(notifier->socket());
+        delete notifier;
+        ::close(fd);
+    }
+    delete d_ptr;
+}
+
+/*!
+ * Registers the child process \a pid, whose exit is reported to \a callback
+ * and through childExited(). A child which has already exited is reported at
+ * once, so it is safe to call this after \c fork() returns in the parent.
+ */
+void UnixChildReaper::watchChild(qint64 pid, const Callback &callback)
+{
+    Q_D(UnixChildReaper);
+
+    if (pid <= 0) {
+        qCWarning(lcSigwatch) << "UnixChildReaper: invalid pid" << pid;
+        return;
+    }
+
+    UnixChildReaperPrivate::Child child;
+    child.callback = callback;
+    if (d->havePidfd() && !d->watchPidfd(pid, child)) {
+        if (errno == ESRCH) {
+            // Not a live process: report it now, with whatever waitpid() tells
+            d->children.insert(pid, child);
+            d->reapChild(pid);
+            return;
+        }
+        // Out of descriptors or memory: the child lives on, so fall back to
+        // SIGCHLD for it
+        qCWarning(lcSigwatch) << "UnixChildReaper: pidfd_open" << pid << ": " << ::strerror(errno);
+        d->watchSigChild();
+    }
+    d->children.insert(pid, child);
+
+    // The SIGCHLD of a child that exited before now may already be consumed,
+    // while a pidfd is readable at once for a child that already exited
+    if (!child.notifier)
+        d->reapChild(pid);
+}
+
+/*!
+ * Returns the number of registered children that have not exited yet.
+ */
+int UnixChildReaper::childCount() const
+{
+    Q_D(const UnixChildReaper);
+    return d->children.count();
+}
+
+/*!
+ * Sets whether exited children that were not registered with watchChild() are
+ * reaped as well. Defaults to false. Enabling it watches \c SIGCHLD even when
+ * pidfds are supported.
+ */
+void UnixChildReaper::setReapAll(bool reapAll)
+{
+    Q_D(UnixChildReaper);
+    d->reapAll = reapAll;
+
+    // Unregistered children can only be noticed through SIGCHLD
+    if (reapAll)
+        d->watchSigChild();
+}
+
+bool UnixChildReaper::reapsAll() const
+{
+    Q_D(const UnixChildReaper);
+    return d->reapAll;
+}
+
+/*!
+ * Collects every exited child. Called on each \c SIGCHLD; since the signal is
+ * coalesced, one call may find many children, so it loops until none is left.
+ */
+void UnixChildReaper::reap()
+{
+    Q_D(UnixChildReaper);
+
+    for (;;) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (::waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != ECHILD)
+                qCWarning(lcSigwatch) << "UnixChildReaper: waitid: " << ::strerror(errno);
+            return;
+        }
+        if (info.si_pid == 0)
+            return;     // No more exited children
+
+        const qint64 pid = info.si_pid;
+        if (!d->reapAll && !d->children.contains(pid)) {
+            // Not ours to reap, and it hides any other exited child
+            d->reapRegistered();
+            return;
+        }
+        d->reapChild(pid);
+    }
+}
+
+/*!
+ * \fn void UnixChildReaper::childExited(qint64 pid, int status)
+ * Emitted when the child \a pid has been reaped, after its callback has been
+ * called. The \a status is as returned by \c waitpid(), or -1 if the child was
+ * reaped elsewhere.
+ */
+
+#include "moc_sigreap.cpp"
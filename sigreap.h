@@ -0,0 +1,76 @@
+/*
+ * Child process reaping on SIGCHLD for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGREAP_H
+#define SIGREAP_H
+
+#include <QObject>
+#include <functional>
+
+class UnixSignalWatcher;
+class UnixChildReaperPrivate;
+
+
+/*!
+ * \brief The UnixChildReaper class reaps child processes on \c SIGCHLD and
+ * reports their exit.
+ *
+ * Register each child with watchChild(), optionally with a callback. Whenever
+ * the watcher catches \c SIGCHLD, coalesced so that a burst of exits costs a
+ * single wakeup, every exited child is collected without blocking and its
+ * callback is called with its \c waitpid() status.
+ *
+ * By default only registered children are reaped, so that children owned by
+ * someone else, such as a QProcess, are left alone. With setReapAll(true),
+ * any exited child is reaped and reported through childExited().
+ */
+class UnixChildReaper : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(UnixChildReaper)
+
+public:
+    typedef std::function<void(qint64 pid, int status)> Callback;
+
+    explicit UnixChildReaper(UnixSignalWatcher *watcher, QObject *parent = 0);
+    ~UnixChildReaper();
+
+    void watchChild(qint64 pid, const Callback &callback = Callback());
+    int childCount() const;
+
+    void setReapAll(bool reapAll);
+    bool reapsAll() const;
+
+public slots:
+    void reap();
+
+signals:
+    void childExited(qint64 pid, int status);
+
+private:
+    UnixChildReaperPrivate * const d_ptr;
+    Q_PRIVATE_SLOT(d_func(), void _q_onSignal(int))
+};
+
+#endif // SIGREAP_H
@@ -0,0 +1,232 @@
+/*
+ * Configuration reload on SIGHUP for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sigreload.h"
+#include "sigwatch.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
+Q_DECLARE_LOGGING_CATEGORY(lcSigwatch)
+
+/*!
+ * \brief The UnixSignalReloaderBasePrivate class debounces reload requests
+ * and runs them, one at a time, on a single-threaded pool.
+ */
+class UnixSignalReloaderBasePrivate
+{
+    UnixSignalReloaderBase * const q_ptr;
+    Q_DECLARE_PUBLIC(UnixSignalReloaderBase)
+
+public:
+    UnixSignalReloaderBasePrivate(UnixSignalReloaderBase *q);
+
+    bool runLoad();
+
+    void _q_onHangup();
+    void _q_onLoaded(bool ok);
+
+    QThreadPool pool;
+    QTimer *debounce;
+    bool reloading;
+    bool reloadAgain;
+};
+
+namespace {
+
+/*!
+ * \brief The LoadRunnable class calls the loader on the pool and reports back
+ * to the reloader's thread.
+ */
+class LoadRunnable : public QRunnable
+{
+public:
+    LoadRunnable(UnixSignalReloaderBasePrivate *d, QObject *reloader) :
+        d(d), reloader(reloader) {}
+
+    void run()
+    {
+        const bool ok = d->runLoad();
+        QMetaObject::invokeMethod(reloader, "_q_onLoaded",
+                                  Qt::QueuedConnection, Q_ARG(bool, ok));
+    }
+
+private:
+    UnixSignalReloaderBasePrivate *d;
+    QObject *reloader;
+};
+
+} // namespace
+
+UnixSignalReloaderBasePrivate::UnixSignalReloaderBasePrivate(UnixSignalReloaderBase *q) :
+    q_ptr(q),
+    debounce(0),
+    reloading(false),
+    reloadAgain(false)
+{
+    pool.setMaxThreadCount(1);
+}
+
+/*!
+ * Calls the loader. Runs on the pool's thread.
+ */
+bool UnixSignalReloaderBasePrivate::runLoad()
+{
+    Q_Q(UnixSignalReloaderBase);
+    return q->load();
+}
+
+void UnixSignalReloaderBasePrivate::_q_onHangup()
+{
+    // Restart the countdown on every signal of a burst
+    debounce->start();
+}
+
+/*!
+ * Called in the reloader's thread when a reload has completed.
+ */
+void UnixSignalReloaderBasePrivate::_q_onLoaded(bool ok)
+{
+    Q_Q(UnixSignalReloaderBase);
+
+    reloading = false;
+    if (ok) {
+        qCDebug(lcSigwatch) << "Reloaded";
+        emit q->reloaded();
+    } else {
+        qCWarning(lcSigwatch) << "UnixSignalReloader: reload failed, keeping the current value";
+        emit q->reloadFailed();
+    }
+
+    if (reloadAgain) {
+        reloadAgain = false;
+        q->reload();
+    }
+}
+
+
+/*!
+ * Create a new reloader as a child of the given \a parent, which reloads when
+ * \a watcher catches \c SIGHUP. The watcher is told to watch for \c SIGHUP,
+ * coalesced. Not available on Windows, where only reload() triggers a reload.
+ */
+UnixSignalReloaderBase::UnixSignalReloaderBase(UnixSignalWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    d_ptr(new UnixSignalReloaderBasePrivate(this))
+{
+    Q_D(UnixSignalReloaderBase);
+
+    d->debounce = new QTimer(this);
+    d->debounce->setSingleShot(true);
+    d->debounce->setInterval(500);
+    connect(d->debounce, SIGNAL(timeout()), this, SLOT(reload()));
+
+#ifdef Q_OS_UNIX
+    watcher->watchForSignal(SIGHUP, UnixSignalWatcher::CoalesceSignals);
+    connect(watcher, SIGNAL(hungup()), this, SLOT(_q_onHangup()));
+#else
+    Q_UNUSED(watcher);
+#endif
+}
+
+UnixSignalReloaderBase::~UnixSignalReloaderBase()
+{
+    waitForReload();
+    delete d_ptr;
+}
+
+/*!
+ * Sets the time without \c SIGHUP to wait for before reloading to \a msec
+ * milliseconds. Defaults to 500.
+ */
+void UnixSignalReloaderBase::setDebounceInterval(int msec)
+{
+    Q_D(UnixSignalReloaderBase);
+    d->debounce->setInterval(msec);
+}
+
+int UnixSignalReloaderBase::debounceInterval() const
+{
+    Q_D(const UnixSignalReloaderBase);
+    return d->debounce->interval();
+}
+
+/*!
+ * Returns true while a reload is running.
+ */
+bool UnixSignalReloaderBase::isReloading() const
+{
+    Q_D(const UnixSignalReloaderBase);
+    return d->reloading;
+}
+
+/*!
+ * Starts a reload now, without waiting for the debounce interval. If a reload
+ * is already running, another one is started once it has completed.
+ */
+void UnixSignalReloaderBase::reload()
+{
+    Q_D(UnixSignalReloaderBase);
+
+    d->debounce->stop();
+    if (d->reloading) {
+        d->reloadAgain = true;
+        return;
+    }
+
+    d->reloading = true;
+    d->pool.start(new LoadRunnable(d, this));
+}
+
+/*!
+ * Waits for a running reload to complete. Subclasses must call this in their
+ * destructor, before the state load() uses is destroyed.
+ */
+void UnixSignalReloaderBase::waitForReload()
+{
+    Q_D(UnixSignalReloaderBase);
+    d->pool.waitForDone();
+}
+
+/*!
+ * \fn bool UnixSignalReloaderBase::load()
+ * Loads and publishes the new value, returning false if it could not be
+ * loaded. Called on the reloader's thread, never concurrently with itself.
+ */
+
+/*!
+ * \fn void UnixSignalReloaderBase::reloaded()
+ * Emitted in the reloader's thread after a new value has been published.
+ */
+
+/*!
+ * \fn void UnixSignalReloaderBase::reloadFailed()
+ * Emitted in the reloader's thread when the loader failed; the current value
+ * is kept.
+ */
+
+#include "moc_sigreload.cpp"
@@ -0,0 +1,166 @@
+/*
+ * Configuration reload on SIGHUP for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGRELOAD_H
+#define SIGRELOAD_H
+
+#include <QObject>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+class UnixSignalWatcher;
+class UnixSignalReloaderBasePrivate;
+
+
+/*!
+ * \brief The UnixSignalReloaderBase class schedules reloads requested with
+ * \c SIGHUP.
+ *
+ * A burst of \c SIGHUP, e.g. from a configuration management tool, is
+ * debounced into a single reload once no signal has arrived for
+ * debounceInterval() milliseconds. The reload runs on a thread of the
+ * reloader's own, never on the watcher's thread; a request made while a reload
+ * runs starts another one right after it.
+ *
+ * Use UnixSignalReloader, which publishes the loaded value.
+ */
+class UnixSignalReloaderBase : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(UnixSignalReloaderBase)
+
+public:
+    explicit UnixSignalReloaderBase(UnixSignalWatcher *watcher, QObject *parent = 0);
+    ~UnixSignalReloaderBase();
+
+    void setDebounceInterval(int msec);
+    int debounceInterval() const;
+
+    bool isReloading() const;
+
+public slots:
+    void reload();
+
+signals:
+    void reloaded();
+    void reloadFailed();
+
+protected:
+    virtual bool load() = 0;
+    void waitForReload();
+
+private:
+    UnixSignalReloaderBasePrivate * const d_ptr;
+    Q_PRIVATE_SLOT(d_func(), void _q_onHangup())
+    Q_PRIVATE_SLOT(d_func(), void _q_onLoaded(bool))
+};
+
+
+/*!
+ * \brief The UnixSignalReloader class reloads a value of type \c Config, e.g.
+ * a parsed configuration file, on \c SIGHUP.
+ *
+ * The loader is called on the reloader's thread and returns the new value, or
+ * a null pointer if loading failed, in which case the current value is kept.
+ * A new value replaces the current one with a single atomic exchange. Readers
+ * calling current() from any thread take no lock and never wait for a reload;
+ * they keep using the value they got until they let go of it. The reloader's
+ * thread instead waits, before freeing its reference to the old value, for
+ * the readers still copying it.
+ *
+ * current() is null until the first reload, which can be started at once with
+ * reload().
+ */
+template <typename Config>
+class UnixSignalReloader : public UnixSignalReloaderBase
+{
+public:
+    typedef std::function<std::shared_ptr<const Config>()> Loader;
+
+    UnixSignalReloader(UnixSignalWatcher *watcher, const Loader &loader, QObject *parent = 0) :
+        UnixSignalReloaderBase(watcher, parent),
+        loader(loader),
+        config(0),
+        readEpoch(0)
+    {
+        readers[0].store(0);
+        readers[1].store(0);
+    }
+
+    ~UnixSignalReloader()
+    {
+        waitForReload();
+        delete config.load();
+    }
+
+    std::shared_ptr<const Config> current() const
+    {
+        // Counted in the epoch still current once counted, so that load()
+        // does not free the value meanwhile
+        int epoch = readEpoch.load();
+        for (;;) {
+            readers[epoch].fetch_add(1);
+            const int now = readEpoch.load();
+            if (now == epoch)
+                break;
+            readers[epoch].fetch_sub(1);
+            epoch = now;
+        }
+        std::shared_ptr<const Config> value;
+        if (const std::shared_ptr<const Config> *published = config.load())
+            value = *published;
+        readers[epoch].fetch_sub(1);
+        return value;
+    }
+
+protected:
+    bool load()
+    {
+        std::shared_ptr<const Config> next = loader();
+        if (!next)
+            return false;
+
+        // Readers from now on count in the other epoch and find the new
+        // value. Only one reload runs at a time, so once those of this epoch
+        // are gone, nobody is left copying the old one.
+        const std::shared_ptr<const Config> *previous =
+                config.exchange(new std::shared_ptr<const Config>(next));
+        const int epoch = readEpoch.load();
+        readEpoch.store(1 - epoch);
+        while (readers[epoch].load() != 0)
+            std::this_thread::yield();
+        delete previous;
+        return true;
+    }
+
+private:
+    Loader loader;
+    std::atomic<const std::shared_ptr<const Config> *> config;
+    std::atomic<int> readEpoch;
+    mutable std::atomic<int> readers[2];   // in current(), per epoch
+};
+
+#endif // SIGRELOAD_H
@@ -0,0 +1,255 @@
+/*
+ * Signal-driven sampling profiler hook for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sigsample.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
+#define SIGWATCH_HAVE_POSIX_TIMERS
+#endif
+
+Q_DECLARE_LOGGING_CATEGORY(lcSigwatch)
+
+/*!
+ * \brief The UnixSignalSamplerPrivate class owns the sampling timer of a
+ * UnixSignalSampler and aggregates its samples.
+ *
+ * Each tick is watched with UnixSignalWatcher::QueueSignals and a direct
+ * handler, so no Qt signal is emitted per sample. The handler only appends the
+ * record to the current batch; the first record of a batch posts _q_flush(),
+ * which runs once the watcher has drained its whole queue.
+ */
+class UnixSignalSamplerPrivate
+{
+    UnixSignalSampler * const q_ptr;
+    Q_DECLARE_PUBLIC(UnixSignalSampler)
+
+public:
+    UnixSignalSamplerPrivate(UnixSignalSampler *q, UnixSignalWatcher *watcher);
+
+    void onSample(const UnixSignalInfo &record);
+    void _q_flush();
+
+    UnixSignalWatcher *watcher;
+    int signal;                 // 0 when stopped
+#ifdef SIGWATCH_HAVE_POSIX_TIMERS
+    timer_t timer;
+#endif
+    QVector<UnixSignalInfo> batch;
+    QHash<quintptr, quint64> histogram;
+    quint64 sampleCount;
+};
+
+UnixSignalSamplerPrivate::UnixSignalSamplerPrivate(UnixSignalSampler *q, UnixSignalWatcher *watcher) :
+    q_ptr(q),
+    watcher(watcher),
+    signal(0),
+    sampleCount(0)
+{
+}
+
+/*!
+ * Called by the watcher for each delivery of the sampling signal. Deliveries
+ * not raised by our own timer, e.g. a \c kill() of the same signal, are
+ * ignored.
+ */
+void UnixSignalSamplerPrivate::onSample(const UnixSignalInfo &record)
+{
+    Q_Q(UnixSignalSampler);
+
+#ifdef SIGWATCH_HAVE_POSIX_TIMERS
+    if (record.code != SI_TIMER || record.pointer != quintptr(this))
+        return;
+#endif
+
+    if (batch.isEmpty())
+        QMetaObject::invokeMethod(q, "_q_flush", Qt::QueuedConnection);
+    batch.append(record);
+}
+
+/*!
+ * Folds the samples of the current batch into the histogram and emits them.
+ */
+void UnixSignalSamplerPrivate::_q_flush()
+{
+    Q_Q(UnixSignalSampler);
+
+    if (batch.isEmpty())
+        return;
+
+    for (int i = 0; i < batch.count(); ++i)
+        ++histogram[batch.at(i).programCounter];
+    sampleCount += batch.count();
+
+    const QVector<UnixSignalInfo> samples = batch;
+    batch.resize(0);
+    emit q->samplesReady(samples);
+}
+
+
+/*!
+ * Create a new sampler as a child of the given \a parent, which receives its
+ * ticks through \a watcher. The \a watcher must outlive the sampler.
+ */
+UnixSignalSampler::UnixSignalSampler(UnixSignalWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    d_ptr(new UnixSignalSamplerPrivate(this, watcher))
+{
+}
+
+UnixSignalSampler::~UnixSignalSampler()
+{
+    stop();
+    delete d_ptr;
+}
+
+/*!
+ * Starts sampling \a frequency times per second with \a signal, restarting
+ * if already active. The watcher is told to watch \a signal; it should not be
+ * used for anything else while sampling.
+ *
+ * The timer signal is directed at the process, so the kernel delivers each
+ * tick to a thread which does not block it. Call
+ * UnixSignalWatcher::blockWatchedSignals() in threads that should not be
+ * sampled. A tick arriving while the previous one is still pending is not
+ * queued again by the kernel, so the effective rate is limited by how often
+ * the watcher's thread wakes up.
+ *
+ * Returns false if the timer could not be created.
+ */
+bool UnixSignalSampler::start(int frequency, int signal)
+{
+    Q_D(UnixSignalSampler);
+
+    stop();
+
+    if (frequency <= 0 || frequency > 1000000) {
+        qCWarning(lcSigwatch) << "UnixSignalSampler: invalid frequency" << frequency;
+        return false;
+    }
+
+#ifdef SIGWATCH_HAVE_POSIX_TIMERS
+    d->watcher->watchForSignal(signal, [d](const UnixSignalInfo &record) { d->onSample(record); },
+                               UnixSignalWatcher::QueueSignals);
+
+    struct sigevent event;
+    ::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = signal;
+    event.sigev_value.sival_ptr = d;
+    if (::timer_create(CLOCK_MONOTONIC, &event, &d->timer)) {
+        qCWarning(lcSigwatch) << "UnixSignalSampler: timer_create: " << ::strerror(errno);
+        d->watcher->unwatchSignal(signal);
+        return false;
+    }
+
+    const qint64 interval = 1000000000 / frequency;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = time_t(interval / 1000000000);
+    spec.it_interval.tv_nsec = long(interval % 1000000000);
+    spec.it_value = spec.it_interval;
+    if (::timer_settime(d->timer, 0, &spec, NULL)) {
+        qCWarning(lcSigwatch) << "UnixSignalSampler: timer_settime: " << ::strerror(errno);
+        ::timer_delete(d->timer);
+        d->watcher->unwatchSignal(signal);
+        return false;
+    }
+
+    d->signal = signal;
+    return true;
+#else
+    Q_UNUSED(signal);
+    qCWarning(lcSigwatch) << "UnixSignalSampler: POSIX timers are not supported on this system";
+    return false;
+#endif
+}
+
+/*!
+ * Stops sampling and stops watching the sampling signal. Samples of the
+ * current batch are emitted first; the histogram is kept.
+ */
+void UnixSignalSampler::stop()
+{
+    Q_D(UnixSignalSampler);
+
+    if (!d->signal)
+        return;
+
+#ifdef SIGWATCH_HAVE_POSIX_TIMERS
+    ::timer_delete(d->timer);
+#endif
+    d->watcher->unwatchSignal(d->signal);
+    d->signal = 0;
+    d->_q_flush();
+}
+
+bool UnixSignalSampler::isActive() const
+{
+    Q_D(const UnixSignalSampler);
+    return d->signal != 0;
+}
+
+/*!
+ * Returns the number of samples aggregated so far.
+ */
+quint64 UnixSignalSampler::sampleCount() const
+{
+    Q_D(const UnixSignalSampler);
+    return d->sampleCount;
+}
+
+/*!
+ * Returns the number of samples aggregated so far for each program counter.
+ * Samples without a program counter are counted under 0. The addresses can be
+ * resolved to symbols with \c dladdr() or an external symbolizer.
+ */
+QHash<quintptr, quint64> UnixSignalSampler::histogram() const
+{
+    Q_D(const UnixSignalSampler);
+    return d->histogram;
+}
+
+/*!
+ * Forgets the samples aggregated so far.
+ */
+void UnixSignalSampler::clear()
+{
+    Q_D(UnixSignalSampler);
+    d->histogram.clear();
+    d->sampleCount = 0;
+}
+
+/*!
+ * \fn void UnixSignalSampler::samplesReady(const QVector<UnixSignalInfo> &samples)
+ * Emitted once per wakeup of the watcher with the \a samples taken since the
+ * previous emission, after they have been added to histogram().
+ */
+
+#include "moc_sigsample.cpp"
@@ -0,0 +1,77 @@
+/*
+ * Signal-driven sampling profiler hook for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGSAMPLE_H
+#define SIGSAMPLE_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <signal.h>
+#include "sigwatch.h"
+
+class UnixSignalSamplerPrivate;
+
+
+/*!
+ * \brief The UnixSignalSampler class samples the program at a fixed rate
+ * through a watched timer signal, as the basis of an in-process profiler.
+ *
+ * start() creates a POSIX timer on \c CLOCK_MONOTONIC which raises a signal,
+ * \c SIGPROF by default, at the requested rate. The watcher's signal handler
+ * records the timestamp and the interrupted program counter of each tick in
+ * its lock-free queue, and the sampler collects the records of each wakeup in
+ * one batch: it counts them per program counter in histogram() and emits
+ * them through samplesReady().
+ *
+ * Program counters are only available with the signal handler back-end, on
+ * the platforms listed in UnixSignalInfo; the other back-ends still give the
+ * timestamps. Not available on systems without POSIX timers, such as macOS.
+ */
+class UnixSignalSampler : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(UnixSignalSampler)
+
+public:
+    explicit UnixSignalSampler(UnixSignalWatcher *watcher, QObject *parent = 0);
+    ~UnixSignalSampler();
+
+    bool start(int frequency, int signal = SIGPROF);
+    void stop();
+    bool isActive() const;
+
+    quint64 sampleCount() const;
+    QHash<quintptr, quint64> histogram() const;
+    void clear();
+
+signals:
+    void samplesReady(const QVector<UnixSignalInfo> &samples);
+
+private:
+    UnixSignalSamplerPrivate * const d_ptr;
+    Q_PRIVATE_SLOT(d_func(), void _q_flush())
+};
+
+#endif // SIGSAMPLE_H
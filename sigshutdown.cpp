@@ -0,0 +1,448 @@
+/*
+ * Graceful shutdown on Unix signals for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sigshutdown.h"
+#include "sigwatch.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+#include <cstdlib>
+
+Q_DECLARE_LOGGING_CATEGORY(lcSigwatch)
+
+namespace {
+
+/*!
+ * \brief The StageLink struct is shared by a coordinator and its runnables,
+ * which may outlive it.
+ *
+ * The coordinator's destructor clears \c coordinator under the mutex, which
+ * the runnables hold while reporting, so that nothing is posted to it once it
+ * is gone. If stages are still running then, the destructor leaves the pool
+ * to them instead: the last runnable to go deletes it.
+ */
+struct StageLink
+{
+    StageLink() : coordinator(0), pool(0), active(0) {}
+
+    QMutex mutex;
+    QObject *coordinator;   // 0 once the coordinator is destroyed
+    QThreadPool *pool;      // set if left to the runnables
+    int active;             // runnables not yet deleted
+};
+
+/*!
+ * \brief The StageRunnable class runs one stage on the coordinator's pool and
+ * reports back to the coordinator's thread when it returns.
+ */
+class StageRunnable : public QRunnable
+{
+public:
+    StageRunnable(const UnixSignalShutdownCoordinator::Stage &stage,
+                  const QSharedPointer<StageLink> &link, int index) :
+        stage(stage), link(link), index(index)
+    {
+        QMutexLocker lock(&link->mutex);
+        ++link->active;
+    }
+
+    ~StageRunnable()
+    {
+        // Deleting the pool waits for its threads, this one included, so
+        // leave that to the pool's own thread
+        QMutexLocker lock(&link->mutex);
+        if (--link->active == 0 && link->pool)
+            link->pool->deleteLater();
+    }
+
+    void run()
+    {
+        stage();
+        QMutexLocker lock(&link->mutex);
+        if (link->coordinator) {
+            QMetaObject::invokeMethod(link->coordinator, "_q_onStageFinished",
+                                      Qt::QueuedConnection, Q_ARG(int, index));
+        }
+    }
+
+private:
+    UnixSignalShutdownCoordinator::Stage stage;
+    QSharedPointer<StageLink> link;
+    int index;
+};
+
+} // namespace
+
+
+/*!
+ * \brief The UnixSignalShutdownCoordinatorPrivate class schedules the stages
+ * of a UnixSignalShutdownCoordinator.
+ *
+ * Stages are kept in registration order and started as soon as every stage
+ * they depend on has finished or timed out. All bookkeeping happens in the
+ * coordinator's thread; the pool threads only run the stage functions.
+ */
+class UnixSignalShutdownCoordinatorPrivate
+{
+    UnixSignalShutdownCoordinator * const q_ptr;
+    Q_DECLARE_PUBLIC(UnixSignalShutdownCoordinator)
+
+public:
+    UnixSignalShutdownCoordinatorPrivate(UnixSignalShutdownCoordinator *q);
+
+    void startReadyStages();
+    void checkFinished();
+
+    void _q_onSignal(int signal);
+    void _q_onStageFinished(int index);
+
+    enum StageState { Pending, Running, Finished, TimedOut, Skipped };
+
+    struct StageEntry
+    {
+        QString name;
+        UnixSignalShutdownCoordinator::Stage stage;
+        int deadline;
+        QStringList dependencies;
+        StageState state;
+        QElapsedTimer started;
+    };
+
+    int indexOf(const QString &name) const;
+    bool isReady(const StageEntry &entry) const;
+    int remainingDeadline() const;
+
+    QVector<StageEntry> stages;
+    QSharedPointer<StageLink> link;
+    QThreadPool *pool;
+    bool shuttingDown;
+    bool done;
+};
+
+UnixSignalShutdownCoordinatorPrivate::UnixSignalShutdownCoordinatorPrivate(UnixSignalShutdownCoordinator *q) :
+    q_ptr(q),
+    link(new StageLink),
+    pool(new QThreadPool),
+    shuttingDown(false),
+    done(false)
+{
+    link->coordinator = q;
+}
+
+int UnixSignalShutdownCoordinatorPrivate::indexOf(const QString &name) const
+{
+    for (int i = 0; i < stages.count(); ++i) {
+        if (stages.at(i).name == name)
+            return i;
+    }
+    return -1;
+}
+
+/*!
+ * Returns true if every stage \a entry depends on has finished or has been
+ * given up on. Unknown dependencies are ignored.
+ */
+bool UnixSignalShutdownCoordinatorPrivate::isReady(const StageEntry &entry) const
+{
+    for (int i = 0; i < entry.dependencies.count(); ++i) {
+        const int dependency = indexOf(entry.dependencies.at(i));
+        if (dependency < 0)
+            continue;
+        const StageState state = stages.at(dependency).state;
+        if (state == Pending || state == Running)
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * Returns the milliseconds left until the last running stage reaches its
+ * deadline, or 0 if no stage is still within it. A stage that has timed out
+ * has no time left, even if it has not returned yet.
+ */
+int UnixSignalShutdownCoordinatorPrivate::remainingDeadline() const
+{
+    qint64 remaining = 0;
+    for (int i = 0; i < stages.count(); ++i) {
+        const StageEntry &entry = stages.at(i);
+        if (entry.state == Running)
+            remaining = qMax(remaining, entry.deadline - entry.started.elapsed());
+    }
+    return int(remaining);
+}
+
+/*!
+ * Starts every pending stage whose dependencies are done, each with a timer
+ * for its deadline.
+ */
+void UnixSignalShutdownCoordinatorPrivate::startReadyStages()
+{
+    Q_Q(UnixSignalShutdownCoordinator);
+
+    for (int i = 0; i < stages.count(); ++i) {
+        StageEntry &entry = stages[i];
+        if (entry.state != Pending || !isReady(entry))
+            continue;
+
+        entry.state = Running;
+        entry.started.start();
+        qCDebug(lcSigwatch) << "Starting shutdown stage" << entry.name;
+        emit q->stageStarted(entry.name);
+
+        QTimer::singleShot(entry.deadline, q, [this, i]() {
+            Q_Q(UnixSignalShutdownCoordinator);
+            StageEntry &overrun = stages[i];
+            if (overrun.state != Running)
+                return;
+            qCWarning(lcSigwatch) << "UnixSignalShutdownCoordinator: stage" << overrun.name
+                                  << "overran its deadline of" << overrun.deadline << "ms";
+            overrun.state = TimedOut;
+            emit q->stageTimedOut(overrun.name);
+            startReadyStages();
+            checkFinished();
+        });
+        pool->start(new StageRunnable(entry.stage, link, i));
+    }
+}
+
+/*!
+ * Emits finished() once no stage is pending or running. Stages left pending
+ * while nothing runs depend on each other and are skipped.
+ */
+void UnixSignalShutdownCoordinatorPrivate::checkFinished()
+{
+    Q_Q(UnixSignalShutdownCoordinator);
+
+    if (done)
+        return;
+
+    bool pending = false;
+    for (int i = 0; i < stages.count(); ++i) {
+        if (stages.at(i).state == Running)
+            return;
+        pending = pending || stages.at(i).state == Pending;
+    }
+
+    if (pending) {
+        for (int i = 0; i < stages.count(); ++i) {
+            if (stages.at(i).state != Pending)
+                continue;
+            qCWarning(lcSigwatch) << "UnixSignalShutdownCoordinator: skipping stage"
+                                  << stages.at(i).name << "with circular dependencies";
+            stages[i].state = Skipped;
+        }
+    }
+
+    done = true;
+    qCDebug(lcSigwatch) << "Shutdown finished";
+    emit q->finished();
+}
+
+/*!
+ * Starts the shutdown on the first \c SIGTERM or \c SIGINT, and exits at once
+ * on the next one.
+ */
+void UnixSignalShutdownCoordinatorPrivate::_q_onSignal(int signal)
+{
+    Q_Q(UnixSignalShutdownCoordinator);
+
+    if (signal != SIGTERM && signal != SIGINT)
+        return;
+
+    if (!shuttingDown) {
+        q->shutdown();
+        return;
+    }
+
+    qCWarning(lcSigwatch) << "UnixSignalShutdownCoordinator: signal" << signal
+                          << "received again, exiting without finishing the shutdown";
+    emit q->aborted(signal);
+    std::_Exit(128 + signal);
+}
+
+/*!
+ * Called in the coordinator's thread when the stage at \a index has returned.
+ */
+void UnixSignalShutdownCoordinatorPrivate::_q_onStageFinished(int index)
+{
+    Q_Q(UnixSignalShutdownCoordinator);
+
+    StageEntry &entry = stages[index];
+    if (entry.state != Running)
+        return;     // Already given up on
+
+    entry.state = Finished;
+    qCDebug(lcSigwatch) << "Finished shutdown stage" << entry.name;
+    emit q->stageFinished(entry.name);
+    startReadyStages();
+    checkFinished();
+}
+
+
+/*!
+ * Create a new UnixSignalShutdownCoordinator as a child of the given
+ * \a parent, which starts the shutdown when \a watcher catches \c SIGTERM or
+ * \c SIGINT. The watcher is told to watch for both signals.
+ */
+UnixSignalShutdownCoordinator::UnixSignalShutdownCoordinator(UnixSignalWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    d_ptr(new UnixSignalShutdownCoordinatorPrivate(this))
+{
+    watcher->watchForTerminate();
+    watcher->watchForInterrupt();
+    connect(watcher, SIGNAL(unixSignal(int)), this, SLOT(_q_onSignal(int)));
+}
+
+/*!
+ * Waits for the stages that are still running, at most until the last of
+ * their deadlines, and destroys the coordinator. Stages waiting for their
+ * dependencies are not started.
+ *
+ * Stages that are still running then, including those already timed out, are
+ * left to finish on their own, and those not picked up by a pool thread yet
+ * are dropped. The pool is deleted once the last of them returns, through the
+ * event loop of the coordinator's thread; if that loop has stopped, e.g. as
+ * the process exits, the pool and its threads are left to the process.
+ */
+UnixSignalShutdownCoordinator::~UnixSignalShutdownCoordinator()
+{
+    Q_D(UnixSignalShutdownCoordinator);
+
+    const bool returned = d->pool->waitForDone(d->remainingDeadline());
+    if (!returned)
+        d->pool->clear();
+
+    QMutexLocker lock(&d->link->mutex);
+    d->link->coordinator = 0;
+    const bool leftRunning = d->link->active > 0;
+    if (leftRunning) {
+        qCWarning(lcSigwatch) << "UnixSignalShutdownCoordinator: destroyed while" << d->link->active
+                              << "stages are still running past their deadlines";
+        d->link->pool = d->pool;
+    }
+    lock.unlock();
+
+    if (!leftRunning)
+        delete d->pool;
+    delete d_ptr;
+}
+
+/*!
+ * Registers a shutdown \a stage called \a name, to be run once every stage
+ * named in \a dependencies is done. The \a stage is called on a thread of the
+ * coordinator's pool, so it must not use objects living in other threads
+ * without synchronisation. It is given up on if it has not returned within
+ * \a deadline milliseconds of being started.
+ *
+ * Stages must be added before the shutdown starts.
+ */
+void UnixSignalShutdownCoordinator::addStage(const QString &name, const Stage &stage, int deadline,
+                                             const QStringList &dependencies)
+{
+    Q_D(UnixSignalShutdownCoordinator);
+
+    if (d->shuttingDown) {
+        qCWarning(lcSigwatch) << "UnixSignalShutdownCoordinator: stage" << name
+                              << "added after the shutdown started";
+        return;
+    }
+    if (d->indexOf(name) >= 0) {
+        qCWarning(lcSigwatch) << "UnixSignalShutdownCoordinator: duplicate stage" << name;
+        return;
+    }
+
+    UnixSignalShutdownCoordinatorPrivate::StageEntry entry;
+    entry.name = name;
+    entry.stage = stage;
+    entry.deadline = deadline;
+    entry.dependencies = dependencies;
+    entry.state = UnixSignalShutdownCoordinatorPrivate::Pending;
+    d->stages.append(entry);
+}
+
+/*!
+ * Returns true once the shutdown has started.
+ */
+bool UnixSignalShutdownCoordinator::isShuttingDown() const
+{
+    Q_D(const UnixSignalShutdownCoordinator);
+    return d->shuttingDown;
+}
+
+/*!
+ * Starts the shutdown as if \c SIGTERM had been caught. Does nothing if it has
+ * already started.
+ */
+void UnixSignalShutdownCoordinator::shutdown()
+{
+    Q_D(UnixSignalShutdownCoordinator);
+
+    if (d->shuttingDown)
+        return;
+    d->shuttingDown = true;
+
+    // Drain steps mostly wait, so let every independent stage run at once
+    d->pool->setMaxThreadCount(qMax(1, d->stages.count()));
+    d->startReadyStages();
+    d->checkFinished();
+}
+
+/*!
+ * \fn void UnixSignalShutdownCoordinator::stageStarted(const QString &name)
+ * Emitted when the stage \a name is started.
+ */
+
+/*!
+ * \fn void UnixSignalShutdownCoordinator::stageFinished(const QString &name)
+ * Emitted when the stage \a name has returned within its deadline.
+ */
+
+/*!
+ * \fn void UnixSignalShutdownCoordinator::stageTimedOut(const QString &name)
+ * Emitted when the stage \a name has overrun its deadline. It keeps running,
+ * but its dependents are started and its eventual return is ignored.
+ */
+
+/*!
+ * \fn void UnixSignalShutdownCoordinator::finished()
+ * Emitted once every stage has finished or timed out. Connect it to
+ * QCoreApplication::quit() to exit when the shutdown is complete.
+ */
+
+/*!
+ * \fn void UnixSignalShutdownCoordinator::aborted(int signal)
+ * Emitted when \a signal is caught again during the shutdown, just before the
+ * process exits with status 128 + \a signal. Only direct connections are
+ * called in time.
+ */
+
+#include "moc_sigshutdown.cpp"
@@ -0,0 +1,82 @@
+/*
+ * Graceful shutdown on Unix signals for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGSHUTDOWN_H
+#define SIGSHUTDOWN_H
+
+#include <QObject>
+#include <QStringList>
+#include <functional>
+
+class UnixSignalWatcher;
+class UnixSignalShutdownCoordinatorPrivate;
+
+
+/*!
+ * \brief The UnixSignalShutdownCoordinator class runs shutdown stages when the
+ * process is asked to terminate.
+ *
+ * Register each step of the shutdown, e.g. draining a queue or closing
+ * connections, with addStage(). On the first \c SIGTERM or \c SIGINT caught by
+ * the watcher, every stage whose dependencies are done is started, in parallel,
+ * on a thread pool owned by the coordinator. A stage that overruns its deadline
+ * is given up on and its dependents are started anyway. finished() is emitted
+ * once every stage is done or given up on.
+ *
+ * A second \c SIGTERM or \c SIGINT skips the remaining stages: aborted() is
+ * emitted and the process exits immediately with status 128 + the signal.
+ */
+class UnixSignalShutdownCoordinator : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(UnixSignalShutdownCoordinator)
+
+public:
+    typedef std::function<void()> Stage;
+
+    explicit UnixSignalShutdownCoordinator(UnixSignalWatcher *watcher, QObject *parent = 0);
+    ~UnixSignalShutdownCoordinator();
+
+    void addStage(const QString &name, const Stage &stage, int deadline,
+                  const QStringList &dependencies = QStringList());
+
+    bool isShuttingDown() const;
+
+public slots:
+    void shutdown();
+
+signals:
+    void stageStarted(const QString &name);
+    void stageFinished(const QString &name);
+    void stageTimedOut(const QString &name);
+    void finished();
+    void aborted(int signal);
+
+private:
+    UnixSignalShutdownCoordinatorPrivate * const d_ptr;
+    Q_PRIVATE_SLOT(d_func(), void _q_onSignal(int))
+    Q_PRIVATE_SLOT(d_func(), void _q_onStageFinished(int))
+};
+
+#endif // SIGSHUTDOWN_H
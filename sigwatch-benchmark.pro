@@ -0,0 +1,8 @@
+TEMPLATE = app
+TARGET   = sigwatch-benchmark
+QT       = core
+CONFIG  += console
+
+include(sigwatch.pri)
+
+SOURCES += benchmark.cpp
@@ -24,24 +24,43 @@
 
 #include "sigwatch.h"
 #include <QDebug>
-
-#ifdef Q_OS_WIN
-#include <QMutex>
-#endif // Q_OS_WIN
+#include <QLoggingCategory>
+#include <QTimer>
 
 #ifdef Q_OS_UNIX
-#include <sys/socket.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <QSocketNotifier>
 #endif
 
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <QWinEventNotifier>
+#endif
+
+#if defined(Q_OS_LINUX) && defined(SIGWATCH_EPOLL)
+#define SIGWATCH_HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif // Q_OS_LINUX && SIGWATCH_EPOLL
+
+Q_DECLARE_LOGGING_CATEGORY(lcSigwatch)
+
 
 /*!
- * \brief The UnixSignalWatcherPrivate class implements the back-end signal
- * handling for the UnixSignalWatcher.
+ * \brief The UnixSignalWatcherPrivate class connects a UnixSignalCore to the
+ * Qt event loop.
  *
- * \see http://qt-project.org/doc/qt-5.0/qtdoc/unix-signals.html
+ * A QSocketNotifier, or a QWinEventNotifier on Windows, watches the core's
+ * descriptor and drains it in the watcher's thread, turning each record into
+ * the Qt signals of the UnixSignalWatcher or a call to its direct handler.
+ *
+ * When built with \c SIGWATCH_EPOLL on Linux, the core's descriptor and the
+ * \c timerfd(2) of every watched timer are gathered in an \c epoll(7) set, so
+ * that a single QSocketNotifier wakes up the watcher for all of them.
+ * Elsewhere, watched timers are plain QTimers.
  */
 class UnixSignalWatcherPrivate
 {
@@ -52,59 +71,106 @@ public:
     UnixSignalWatcherPrivate(UnixSignalWatcher *q);
     ~UnixSignalWatcherPrivate();
 
-    void watchForSignal(int signal);
-    static void signalHandler(int signal);
+    void unwatchSignal(int signal);
+    void setHandler(int signal, const UnixSignalWatcher::SignalHandler &handler);
+    int watchTimer(int interval);
+    void unwatchTimer(int id);
 
     void emitQtSignal(int signal);
+    void emitQtSignals(const UnixSignalInfo &record, int count);
+    void emitTimers();
 
     const char* signalToString(int signal) const;
 
     void _q_onNotify(int sockfd);
 
+    UnixSignalCore core;
+
 private:
-    QList<int> watchedSignals;
+#ifdef SIGWATCH_HAVE_EPOLL
+    bool addToEpoll(int fd);
+    void readEpoll();
+    void readTimer(int fd);
+    void rearmAfterFork();
+#endif
+
+    QVector<int> signalBatch;
+    bool wantBatch;
+    QVector<QPair<int, int> > droppedSignals;
+
+    // Direct handlers, called in place of the Qt signals; watcher's thread only
+    UnixSignalWatcher::SignalHandler handlers[NSIG];
+
+    /*!
+     * A timer watched with watchTimer(), backed by a timerfd in the epoll set
+     * or else by a QTimer.
+     */
+    struct Timer
+    {
+        int id;
+        int fd;             // -1 unless a timerfd
+        QTimer *timer;      // 0 unless a QTimer
+        int expirations;    // read in the current wakeup, not yet emitted
+    };
+    QVector<Timer> timers;
+    int nextTimerId;
 
 #ifdef Q_OS_WIN
-    static QMutex instanceGuard;
-    static UnixSignalWatcherPrivate *instance;
+    QWinEventNotifier *notifier;
 #endif
-
 #ifdef Q_OS_UNIX
-    static int sockpair[2];
     QSocketNotifier *notifier;
 #endif
-};
-
-#ifdef Q_OS_UNIX
-int UnixSignalWatcherPrivate::sockpair[2];
-#endif
-
-#ifdef Q_OS_WIN
-QMutex UnixSignalWatcherPrivate::instanceGuard;
-UnixSignalWatcherPrivate* UnixSignalWatcherPrivate::instance;
+#ifdef SIGWATCH_HAVE_EPOLL
+    int epollFd;
 #endif
+};
 
 
 UnixSignalWatcherPrivate::UnixSignalWatcherPrivate(UnixSignalWatcher *q) :
-    q_ptr(q)
+    q_ptr(q),
+    wantBatch(false),
+    nextTimerId(1)
 {
-#if defined(Q_OS_UNIX)
+    qRegisterMetaType<UnixSignalInfo>("UnixSignalInfo");
+
+    notifier = 0;
+#ifdef SIGWATCH_HAVE_EPOLL
+    epollFd = -1;
+#endif
 
-    // Create socket pair
-    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair)) {
-        qDebug() << "UnixSignalWatcher: socketpair: " << ::strerror(errno);
+    if (!core.isValid())
         return;
+
+#ifdef SIGWATCH_HAVE_EPOLL
+    // Without an epoll set, fall back to a notifier per descriptor
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: epoll_create1: " << ::strerror(errno);
+    else if (!addToEpoll(core.fd())) {
+        ::close(epollFd);
+        epollFd = -1;
     }
+    if (epollFd >= 0)
+        core.setForkCallback([this]() { rearmAfterFork(); });
+#endif
 
-    // Create a notifier for the read end of the pair
-    notifier = new QSocketNotifier(sockpair[1], QSocketNotifier::Read);
+    // Create a notifier for the core. As a child of the watcher it follows it
+    // to another thread with QObject::moveToThread(), so signals are always
+    // read and emitted in the watcher's own thread.
+#if defined(Q_OS_UNIX)
+#ifdef SIGWATCH_HAVE_EPOLL
+    const int notifierFd = epollFd >= 0 ? epollFd : core.fd();
+#else
+    const int notifierFd = core.fd();
+#endif
+    notifier = new QSocketNotifier(notifierFd, QSocketNotifier::Read, q);
     QObject::connect(notifier, SIGNAL(activated(int)), q, SLOT(_q_onNotify(int)));
     notifier->setEnabled(true);
 #elif defined(Q_OS_WIN)
-
-    QMutexLocker lck(&instanceGuard);
-    Q_ASSERT_X(!instance, "UnixSignalWatcher", "Cannot create more than one instance of UnixSignalWatcher");
-    instance = this;
+    notifier = new QWinEventNotifier(HANDLE(core.event()), q);
+    QObject::connect(notifier, &QWinEventNotifier::activated, q, [this]() { _q_onNotify(-1); });
+    notifier->setEnabled(true);
 #else
 #   error "UnixSignalWatcher is not supported on this system"
 #endif
@@ -112,80 +178,110 @@ UnixSignalWatcherPrivate::UnixSignalWatcherPrivate(UnixSignalWatcher *q) :
 
 UnixSignalWatcherPrivate::~UnixSignalWatcherPrivate()
 {
-#if defined(Q_OS_UNIX)
+    while (!timers.isEmpty())
+        unwatchTimer(timers.last().id);
+
     delete notifier;
-#elif defined(Q_OS_WIN)
-    QMutexLocker lck(&instanceGuard);
-    instance = 0;
+#ifdef SIGWATCH_HAVE_EPOLL
+    if (epollFd >= 0)
+        ::close(epollFd);
 #endif
 }
 
 /*!
- * Registers a handler for the given Unix \a signal. The handler will write to
- * a socket pair, the other end of which is connected to a QSocketNotifier.
- * This provides a way to break out of the asynchronous context from which the
- * signal handler is called and back into the Qt event loop.
+ * Stops watching \a signal and forgets its direct handler.
  */
-void UnixSignalWatcherPrivate::watchForSignal(int signal)
+void UnixSignalWatcherPrivate::unwatchSignal(int signal)
 {
-    if (watchedSignals.contains(signal)) {
-        qDebug() << "Already watching for signal" << signal;
+    if (!core.isWatched(signal))
         return;
-    }
 
-#if defined(Q_OS_UNIX)
-    // Register a sigaction which will write to the socket pair
-    struct sigaction sigact;
-    sigact.sa_handler = UnixSignalWatcherPrivate::signalHandler;
-    ::sigemptyset(&sigact.sa_mask);
-    sigact.sa_flags |= SA_RESTART;
-    if (::sigaction(signal, &sigact, NULL)) {
-        qDebug() << "UnixSignalWatcher: sigaction: " << ::strerror(errno);
-        return;
-    }
+    handlers[signal] = UnixSignalWatcher::SignalHandler();
+    core.unwatchSignal(signal);
+}
 
-#elif defined(Q_OS_WIN)
-    // Register signal handler.
-    if (::signal(signal, UnixSignalWatcherPrivate::signalHandler) == SIG_ERR) {
-        qDebug() << "UnixSignalWatcher: signal: " << ::strerror(errno);
+/*!
+ * Sets the \a handler called for each delivery of the watched \a signal, or
+ * restores the Qt signals if \a handler is empty.
+ */
+void UnixSignalWatcherPrivate::setHandler(int signal, const UnixSignalWatcher::SignalHandler &handler)
+{
+    if (!core.isWatched(signal))
         return;
-    }
 
-#else
-#   error "UnixSignalWatcher is not supported on this system"
-#endif
-
-    watchedSignals.append(signal);
+    handlers[signal] = handler;
 }
 
 /*!
- * Called when a Unix \a signal is received. Write to the socket to wake up the
- * QSocketNotifier. On Windows this calls the UnixSignalWatcher::unixSignal(int)
- * Qt signal directly.
+ * Starts a periodic timer firing every \a interval milliseconds and returns
+ * its id, or -1 if it could not be created.
  */
-void UnixSignalWatcherPrivate::signalHandler(int signal)
+int UnixSignalWatcherPrivate::watchTimer(int interval)
 {
-#if defined(Q_OS_UNIX)
-    ssize_t nBytes = ::write(sockpair[0], &signal, sizeof(signal));
-    Q_UNUSED(nBytes);
+    Q_Q(UnixSignalWatcher);
 
-#elif defined(Q_OS_WIN)
-    QMutexLocker lck(&instanceGuard);
-    //NOTE: Because Windows creates a special thread through which it delivers
-    //      Unix signals, there is no danger of deadlock, even if another thread
-    //      of the program was inside destructor's mutex lock at the time this
-    //      signal was delivered. In that case, the signal will just be ignored
-    //      because instance will be atomically set to zero and
-    //      UnixSignalWatcher destroyed.
-    if (instance) {
-        instance->emitQtSignal(signal);
+    if (interval <= 0) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: invalid timer interval" << interval;
+        return -1;
     }
 
-#else
-#   error "UnixSignalWatcher is not supported on this system"
+    Timer entry;
+    entry.id = nextTimerId++;
+    entry.fd = -1;
+    entry.timer = 0;
+    entry.expirations = 0;
+
+#ifdef SIGWATCH_HAVE_EPOLL
+    if (epollFd >= 0) {
+        entry.fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (entry.fd < 0) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: timerfd_create: " << ::strerror(errno);
+            return -1;
+        }
+
+        struct itimerspec spec;
+        spec.it_interval.tv_sec = interval / 1000;
+        spec.it_interval.tv_nsec = long(interval % 1000) * 1000000;
+        spec.it_value = spec.it_interval;
+        if (::timerfd_settime(entry.fd, 0, &spec, NULL) || !addToEpoll(entry.fd)) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: timerfd_settime: " << ::strerror(errno);
+            ::close(entry.fd);
+            return -1;
+        }
+        timers.append(entry);
+        return entry.id;
+    }
 #endif
+
+    // A QTimer expires at most once per activation
+    const int id = entry.id;
+    entry.timer = new QTimer(q);
+    entry.timer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(entry.timer, &QTimer::timeout, q, [q, id]() { emit q->timerExpired(id, 1); });
+    entry.timer->start(interval);
+    timers.append(entry);
+    return id;
 }
 
+/*!
+ * Stops and forgets the timer \a id.
+ */
+void UnixSignalWatcherPrivate::unwatchTimer(int id)
+{
+    for (int i = 0; i < timers.count(); ++i) {
+        if (timers.at(i).id != id)
+            continue;
+
+        const Timer entry = timers.at(i);
+        timers.remove(i);
+        if (entry.fd >= 0)
+            ::close(entry.fd);  // also removes it from the epoll set
+        delete entry.timer;
+        return;
+    }
+}
+
+
 /*!
  * Emits the Qt signal(s) on UnixSignalWatcher public interface for the given
  * Unix \a signal.
@@ -194,65 +290,226 @@ void UnixSignalWatcherPrivate::emitQtSignal(int signal)
 {
     Q_Q(UnixSignalWatcher);
 
-    qDebug() << "Caught signal:" << signalToString(signal);
+    qCDebug(lcSigwatch) << "Caught signal:" << signalToString(signal);
 
     emit q->unixSignal(signal);
-    if (signal == SIGINT) emit q->interrupted();
-    if (signal == SIGTERM) emit q->terminated();
+    switch (signal) {
+    case SIGINT: emit q->interrupted(); break;
+    case SIGTERM: emit q->terminated(); break;
 #ifdef Q_OS_UNIX
-    if (signal == SIGHUP) emit q->hungup();
+    case SIGHUP: emit q->hungup(); break;
 #endif
 #ifdef Q_OS_WIN
-    if (signal == SIGBREAK) emit q->broken();
+    case SIGBREAK: emit q->broken(); break;
 #endif
+    default: break;
+    }
 }
 
+/*!
+ * Emits the Qt signal(s) for the Unix signal in \a record, which stands for
+ * \a count deliveries, or calls its direct handler instead. Called by the core
+ * for each record it drains, in order; the signal is appended to the batch
+ * emitted once the core is drained.
+ */
+void UnixSignalWatcherPrivate::emitQtSignals(const UnixSignalInfo &record, int count)
+{
+    Q_Q(UnixSignalWatcher);
+
+    const int signal = record.signal;
+
+    // A direct handler replaces all the Qt signals for its signal. It may
+    // unwatch or re-register the signal, so it must not run from its slot.
+    const UnixSignalWatcher::SignalHandler handler = handlers[signal];
+    if (handler) {
+        handler(record);
+        return;
+    }
+
+    emitQtSignal(signal);
+    const int options = core.watchOptions(signal);
+    if (options & UnixSignalWatcher::CoalesceSignals)
+        emit q->unixSignalCoalesced(signal, count);
+    if (options & UnixSignalWatcher::SignalInfo)
+        emit q->unixSignalInfo(record);
+
+    if (wantBatch)
+        signalBatch.append(signal);
+}
+
+/*!
+ * Returns a human readable description of \a signal.
+ */
 const char *UnixSignalWatcherPrivate::signalToString(int signal) const
 {
-#if defined(Q_OS_UNIX)
-    return ::strsignal(signal);
+    return UnixSignalCore::signalName(signal);
+}
 
-#elif defined(Q_OS_WIN)
-    switch (signal) {
-    case SIGINT:
-        return "Interrupt";
-    case SIGILL:
-        return "Illegal instruction";
-    case SIGFPE:
-        return "Arithmetic exception";
-    case SIGSEGV:
-        return "Segmentation fault";
-    case SIGTERM:
-        return "Terminated";
-    case SIGBREAK:
-        return "Break";
-    case SIGABRT:
-    case SIGABRT_COMPAT:
-        return "Aborted";
-    default:
-        return "Other signal";
+#ifdef SIGWATCH_HAVE_EPOLL
+/*!
+ * Adds \a fd to the epoll set, to be reported when readable.
+ */
+bool UnixSignalWatcherPrivate::addToEpoll(int fd)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event)) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: epoll_ctl: " << ::strerror(errno);
+        return false;
     }
-#endif
+    return true;
 }
 
 /*!
- * Called when the signal handler has written to the socket pair. Emits the Unix
- * signal as a Qt signal.
+ * Reads the expired timers the epoll set reports as ready, without blocking.
+ * The core is drained in any case afterwards.
  */
-void UnixSignalWatcherPrivate::_q_onNotify(int sockfd)
+void UnixSignalWatcherPrivate::readEpoll()
 {
-#ifdef Q_OS_UNIX
-    int signal;
-    ssize_t nBytes = ::read(sockfd, &signal, sizeof(signal));
-    Q_UNUSED(nBytes);
+    struct epoll_event events[8];
+    const int capacity = sizeof(events) / sizeof(events[0]);
+
+    for (;;) {
+        const int count = ::epoll_wait(epollFd, events, capacity, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: epoll_wait: " << ::strerror(errno);
+
+        for (int i = 0; i < count; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd != core.fd())
+                readTimer(fd);
+        }
+
+        if (count < capacity)
+            break;
+    }
+}
 
-    emitQtSignal(signal);
+/*!
+ * Reads the number of expirations of the timerfd \a fd, which are emitted
+ * after the signals of the current wakeup.
+ */
+void UnixSignalWatcherPrivate::readTimer(int fd)
+{
+    quint64 expirations;
+    if (::read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
 
-#else
-    Q_UNUSED(sockfd)
-#endif // Q_OS_UNIX
+    for (int i = 0; i < timers.count(); ++i) {
+        if (timers.at(i).fd == fd) {
+            timers[i].expirations += int(expirations);
+            return;
+        }
+    }
 }
 
+/*!
+ * Called in the child after \c fork(). The epoll set and the timerfds are
+ * shared with the parent, which would consume the child's expirations, so
+ * each is replaced by a private one under the same number, the timers keeping
+ * their phase. The core has already replaced its own descriptor.
+ */
+void UnixSignalWatcherPrivate::rearmAfterFork()
+{
+    // Takes over the number of target, which stays close-on-exec
+    auto replace = [](int fd, int target) {
+        int result;
+        while ((result = ::dup2(fd, target)) < 0 && errno == EINTR)
+            ;
+        if (result < 0)
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: dup2: " << ::strerror(errno);
+        else
+            ::fcntl(target, F_SETFD, ::fcntl(target, F_GETFD) | FD_CLOEXEC);
+        ::close(fd);
+    };
+
+    for (int i = 0; i < timers.count(); ++i) {
+        const int fd = timers.at(i).fd;
+        if (fd < 0)
+            continue;
+
+        struct itimerspec spec;
+        const int fresh = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fresh < 0 || ::timerfd_gettime(fd, &spec) || ::timerfd_settime(fresh, 0, &spec, NULL)) {
+            qCWarning(lcSigwatch) << "UnixSignalWatcher: timerfd: " << ::strerror(errno);
+            if (fresh >= 0)
+                ::close(fresh);
+            continue;
+        }
+        replace(fresh, fd);
+        timers[i].expirations = 0;
+    }
+
+    const int shared = epollFd;
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: epoll_create1: " << ::strerror(errno);
+        epollFd = shared;
+        return;
+    }
+    addToEpoll(core.fd());
+    for (int i = 0; i < timers.count(); ++i) {
+        if (timers.at(i).fd >= 0)
+            addToEpoll(timers.at(i).fd);
+    }
+    replace(epollFd, shared);
+    epollFd = shared;
+}
+#endif // SIGWATCH_HAVE_EPOLL
+
+/*!
+ * Emits UnixSignalWatcher::timerExpired() for every timer read in the current
+ * wakeup. A slot may unwatch timers, so each is looked up again.
+ */
+void UnixSignalWatcherPrivate::emitTimers()
+{
+    Q_Q(UnixSignalWatcher);
+
+    QVector<QPair<int, int> > expired;
+    for (int i = 0; i < timers.count(); ++i) {
+        if (timers.at(i).expirations) {
+            expired.append(qMakePair(timers.at(i).id, timers.at(i).expirations));
+            timers[i].expirations = 0;
+        }
+    }
+    for (int i = 0; i < expired.count(); ++i)
+        emit q->timerExpired(expired.at(i).first, expired.at(i).second);
+}
+
+/*!
+ * Called when the core's descriptor, or the epoll set, is readable. Drains
+ * every signal caught since the last call and emits them as Qt signals in one
+ * pass, followed by UnixSignalWatcher::unixSignalsBatch(), the dropped
+ * deliveries and, with the epoll set, the expired timers.
+ */
+void UnixSignalWatcherPrivate::_q_onNotify(int sockfd)
+{
+    Q_Q(UnixSignalWatcher);
+
+#if defined(SIGWATCH_HAVE_EPOLL)
+    if (epollFd >= 0 && sockfd == epollFd)
+        readEpoll();
+#else
+    Q_UNUSED(sockfd);
+#endif
+
+    wantBatch = q->receivers(SIGNAL(unixSignalsBatch(QVector<int>))) > 0;
+    signalBatch.resize(0);
+    droppedSignals.resize(0);
+
+    core.drain([this](const UnixSignalInfo &record, int count) { emitQtSignals(record, count); },
+               [this](int signal, int count) { droppedSignals.append(qMakePair(signal, count)); });
+
+    if (wantBatch && !signalBatch.isEmpty())
+        emit q->unixSignalsBatch(signalBatch);
+    for (int i = 0; i < droppedSignals.count(); ++i)
+        emit q->unixSignalsDropped(droppedSignals.at(i).first, droppedSignals.at(i).second);
+
+    emitTimers();
+}
 
 /*!
  * Create a new UnixSignalWatcher as a child of the given \a parent.
@@ -276,11 +533,192 @@ UnixSignalWatcher::~UnixSignalWatcher()
  *
  * After calling this method you can \c connect() to the unixSignal() Qt signal
  * to be notified when the Unix signal is received.
+ *
+ * The \a options control how deliveries of the \a signal are reported.
+ * Calling this again for a signal that is already watched updates its options.
+ *
+ * \sa WatchOption
  */
-void UnixSignalWatcher::watchForSignal(int signal)
+void UnixSignalWatcher::watchForSignal(int signal, WatchOptions options)
 {
     Q_D(UnixSignalWatcher);
-    d->watchForSignal(signal);
+    d->core.watchSignal(signal, int(options));
+}
+
+/*!
+ * Watches every signal in \a signalList with the same \a options, installing
+ * them together so that none of them can arrive while only some are caught.
+ *
+ * \sa watchForSignal()
+ */
+void UnixSignalWatcher::watchForSignals(const QList<int> &signalList, WatchOptions options)
+{
+    Q_D(UnixSignalWatcher);
+    QVector<int> list;
+    for (int i = 0; i < signalList.count(); ++i)
+        list.append(signalList.at(i));
+    d->core.watchSignals(list.constData(), list.count(), int(options));
+}
+
+/*!
+ * Stops watching \a signal: no Qt signal or handler is called for it any more.
+ * Once no watcher is left for \a signal, its previous disposition, saved when
+ * it was first watched, is restored, so it costs nothing from then on. The
+ * same happens for every watched signal when the watcher is destroyed.
+ */
+void UnixSignalWatcher::unwatchSignal(int signal)
+{
+    Q_D(UnixSignalWatcher);
+    d->unwatchSignal(signal);
+}
+
+/*!
+ * \overload
+ */
+void UnixSignalWatcher::watchForSignals(std::initializer_list<int> signalList, WatchOptions options)
+{
+    Q_D(UnixSignalWatcher);
+    d->core.watchSignals(signalList.begin(), int(signalList.size()), int(options));
+}
+
+#ifdef Q_OS_UNIX
+/*!
+ * \overload
+ *
+ * Watches every signal in \a signalSet.
+ */
+void UnixSignalWatcher::watchForSignals(const sigset_t &signalSet, WatchOptions options)
+{
+    Q_D(UnixSignalWatcher);
+
+    int signalList[NSIG];
+    int count = 0;
+    for (int i = 1; i < NSIG; ++i) {
+        if (::sigismember(&signalSet, i) == 1)
+            signalList[count++] = i;
+    }
+    d->core.watchSignals(signalList, count, int(options));
+}
+#endif
+
+/*!
+ * \overload
+ *
+ * Watches for \a signal and calls \a handler for each delivery instead of
+ * emitting unixSignal() and the other Qt signals. The handler is called
+ * directly from the watcher's thread, which avoids the cost of a Qt signal
+ * emission for signals received at a high rate.
+ *
+ * With UnixSignalWatcher::CoalesceSignals, the handler is called once with the
+ * record of the first delivery; statistics() tells how many were coalesced.
+ * Call this from the thread the watcher lives in.
+ */
+void UnixSignalWatcher::watchForSignal(int signal, const SignalHandler &handler, WatchOptions options)
+{
+    Q_D(UnixSignalWatcher);
+    d->core.watchSignal(signal, int(options));
+    d->setHandler(signal, handler);
+}
+
+/*!
+ * \fn void UnixSignalWatcher::watchForSignal(int signal, Receiver *receiver, void (Receiver::*method)(const UnixSignalInfo &), WatchOptions options)
+ * \overload
+ *
+ * Watches for \a signal and calls \a method on \a receiver for each delivery.
+ * The \a receiver must outlive the watcher.
+ */
+
+/*!
+ * Returns a snapshot of the delivery statistics for \a signal since it was
+ * first watched. This is cheap and may be called from any thread.
+ */
+UnixSignalStatistics UnixSignalWatcher::statistics(int signal) const
+{
+    Q_D(const UnixSignalWatcher);
+    return d->core.statistics(signal);
+}
+
+/*!
+ * Returns a snapshot of the latencies of \a signal since it was first watched,
+ * from the handler's timestamp to the emission of the Qt signals or the call
+ * of the direct handler. A long tail while the counts stay low points at a
+ * stalled event loop rather than at the kernel. Safe to call from any thread.
+ */
+UnixSignalLatencyHistogram UnixSignalWatcher::latencyHistogram(int signal) const
+{
+    Q_D(const UnixSignalWatcher);
+    return d->core.latencyHistogram(signal);
+}
+
+/*!
+ * \property UnixSignalWatcher::statistics
+ * The statistics of every watched signal, keyed by signal number. Each value
+ * is a QVariantMap with the fields of UnixSignalStatistics, and the 50th, 99th
+ * and 99.9th latency percentiles as \c latencyP50, \c latencyP99 and
+ * \c latencyP999, latencies in nanoseconds. Intended for exporting to
+ * monitoring; use statistics(int) in code.
+ */
+QVariantMap UnixSignalWatcher::statisticsMap() const
+{
+    Q_D(const UnixSignalWatcher);
+
+    QVariantMap map;
+    const QVector<int> watchedSignals = d->core.watchedSignals();
+    for (int i = 0; i < watchedSignals.count(); ++i) {
+        const int signal = watchedSignals.at(i);
+        const UnixSignalStatistics stats = d->core.statistics(signal);
+        const UnixSignalLatencyHistogram histogram = d->core.latencyHistogram(signal);
+
+        QVariantMap entry;
+        entry.insert(QStringLiteral("name"), QString::fromLatin1(d->signalToString(signal)));
+        entry.insert(QStringLiteral("delivered"), stats.delivered);
+        entry.insert(QStringLiteral("coalesced"), stats.coalesced);
+        entry.insert(QStringLiteral("dropped"), stats.dropped);
+        entry.insert(QStringLiteral("maxQueueDepth"), stats.maxQueueDepth);
+        entry.insert(QStringLiteral("totalLatency"), stats.totalLatency);
+        entry.insert(QStringLiteral("maxLatency"), stats.maxLatency);
+        entry.insert(QStringLiteral("latencyP50"), histogram.percentile(0.5));
+        entry.insert(QStringLiteral("latencyP99"), histogram.percentile(0.99));
+        entry.insert(QStringLiteral("latencyP999"), histogram.percentile(0.999));
+        map.insert(QString::number(signal), entry);
+    }
+    return map;
+}
+
+/*!
+ * Returns the statistics and latency histograms of every watched signal in
+ * the Prometheus text exposition format, for a metrics endpoint.
+ *
+ * \sa UnixSignalCore::prometheusMetrics()
+ */
+QByteArray UnixSignalWatcher::prometheusMetrics() const
+{
+    Q_D(const UnixSignalWatcher);
+    return d->core.prometheusMetrics();
+}
+
+/*!
+ * Starts a periodic timer firing every \a interval milliseconds, reported
+ * through timerExpired(), and returns its id, or -1 on failure.
+ *
+ * When built with \c SIGWATCH_EPOLL on Linux, the timer is a \c timerfd(2)
+ * in the same epoll set as the signals, so one wakeup of the watcher's thread
+ * serves both, and expirations missed while the thread was busy are counted
+ * rather than lost. Otherwise it is a precise QTimer.
+ */
+int UnixSignalWatcher::watchTimer(int interval)
+{
+    Q_D(UnixSignalWatcher);
+    return d->watchTimer(interval);
+}
+
+/*!
+ * Stops the timer \a id started with watchTimer().
+ */
+void UnixSignalWatcher::unwatchTimer(int id)
+{
+    Q_D(UnixSignalWatcher);
+    d->unwatchTimer(id);
 }
 
 void UnixSignalWatcher::watchForInterrupt()
@@ -311,6 +749,184 @@ void UnixSignalWatcher::watchForBreak()
 #endif
 }
 
+/*!
+ * Returns the real-time signal number \c SIGRTMIN + \a offset, or -1 if there
+ * is no such signal on this system.
+ */
+int UnixSignalWatcher::realTimeSignal(int offset)
+{
+#ifdef SIGRTMIN
+    if (offset >= 0 && offset <= SIGRTMAX - SIGRTMIN)
+        return SIGRTMIN + offset;
+#else
+    Q_UNUSED(offset);
+#endif
+    return -1;
+}
+
+/*!
+ * Sends \a signal to process \a pid with \c sigqueue(), carrying \a value.
+ *
+ * Real-time signals sent this way are queued by the kernel rather than merged.
+ * A watcher which watches \a signal with QueueSignals receives each of them, in
+ * order, and the \a value is available as UnixSignalInfo::value. Returns false
+ * if the signal could not be queued, e.g. when the receiver's queue is full.
+ */
+bool UnixSignalWatcher::queueSignal(qint64 pid, int signal, int value)
+{
+#ifdef SIGRTMIN
+    union sigval sigValue;
+    sigValue.sival_int = value;
+    if (::sigqueue(pid_t(pid), signal, sigValue)) {
+        qCWarning(lcSigwatch) << "UnixSignalWatcher: sigqueue: " << ::strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(pid);
+    Q_UNUSED(signal);
+    Q_UNUSED(value);
+    qCWarning(lcSigwatch) << "UnixSignalWatcher: sigqueue is not supported on this system";
+    return false;
+#endif
+}
+
+/*!
+ * Blocks every signal watched so far, by any watcher, in the calling thread.
+ *
+ * Call this when a latency-sensitive thread starts so that the signal handler
+ * never preempts it; the kernel then delivers the watched signals to a thread
+ * that does not block them. Blocking them in the main thread after watching
+ * them, before any other thread is started, blocks them in every thread but
+ * the one which then calls unblockWatchedSignals(), e.g. the watcher's thread.
+ *
+ * Signals sent to a specific thread, e.g. with \c raise() or
+ * \c pthread_kill(), stay pending while that thread blocks them.
+ *
+ * Returns false if the signal mask could not be changed, or on systems
+ * without signal masks.
+ */
+bool UnixSignalWatcher::blockWatchedSignals()
+{
+    return UnixSignalCore::maskWatchedSignals(true);
+}
+
+/*!
+ * Unblocks every signal watched so far in the calling thread, which becomes a
+ * thread the watched signals can be delivered to.
+ *
+ * With the signalfd and sigwait back-ends the watched signals must remain
+ * blocked everywhere, so this does nothing and returns false.
+ *
+ * \sa blockWatchedSignals()
+ */
+bool UnixSignalWatcher::unblockWatchedSignals()
+{
+    return UnixSignalCore::maskWatchedSignals(false);
+}
+
+/*!
+ * Sets what every watcher does in the child after \c fork().
+ *
+ * With RearmInChild, the default, a child keeps its inherited watchers: they
+ * watch the same signals and timers through descriptors of their own, and
+ * their notifiers keep working, so a pre-forked worker needs no new watcher.
+ * Signals caught by the parent but not yet emitted are not emitted in the
+ * child. With DisableInChild, every watcher of the child stops watching and
+ * the signals get their previous dispositions back; watching them again in
+ * the child works as usual.
+ *
+ * Not on Windows, which has no \c fork().
+ */
+void UnixSignalWatcher::setForkPolicy(ForkPolicy policy)
+{
+    UnixSignalCore::setForkPolicy(UnixSignalCore::ForkPolicy(policy));
+}
+
+/*!
+ * \enum UnixSignalWatcher::WatchOption
+ *
+ * \value NoWatchOptions
+ *        Every delivery of the signal is emitted separately.
+ * \value CoalesceSignals
+ *        Deliveries are counted and emitted once per wakeup, followed by
+ *        unixSignalCoalesced() with the number of deliveries. Useful for
+ *        signals such as \c SIGCHLD or \c SIGWINCH where only the fact that
+ *        at least one arrived matters.
+ * \value SignalInfo
+ *        The details of each delivery are emitted through unixSignalInfo().
+ *        Combined with CoalesceSignals, only the delivery that woke up the
+ *        watcher is reported.
+ * \value QueueSignals
+ *        For real-time signals (\c SIGRTMIN to \c SIGRTMAX), typically sent
+ *        with queueSignal(). Every queued delivery is emitted through
+ *        unixSignalInfo() with its value, in the order the handler received
+ *        them. Implies SignalInfo and overrides CoalesceSignals. Once the
+ *        watcher's queue is half full, further deliveries are left pending in
+ *        the kernel until it has drained, so none is lost before the sender
+ *        sees \c EAGAIN. With the signal handler back-end, only deliveries
+ *        to the watcher's own thread are held back; block the signal in the
+ *        other threads to lose none.
+ * \value HighPriority
+ *        Deliveries are queued apart from the other signals and emitted
+ *        before them, including ahead of the rest of a wakeup already being
+ *        emitted, and a full queue of other signals does not drop them. Meant
+ *        for \c SIGTERM and \c SIGINT, so that shutdown is not held up by a
+ *        burst of \c SIGCHLD or real-time signals.
+ */
+
+/*!
+ * \enum UnixSignalWatcher::ForkPolicy
+ *
+ * \value RearmInChild
+ *        A child created with \c fork() keeps watching through descriptors of
+ *        its own.
+ * \value DisableInChild
+ *        A child stops watching, and the signals get their previous
+ *        dispositions back.
+ *
+ * \sa setForkPolicy()
+ */
+
+/*!
+ * \fn void UnixSignalWatcher::unixSignalsDropped(int signal, int count)
+ * Emitted when \a count deliveries of the Unix \a signal were lost because the
+ * watcher's queue was full. The queue holds \c SIGWATCH_QUEUE_CAPACITY records
+ * (1024 by default); raise it if bursts larger than that are expected between
+ * two iterations of the event loop. Coalesced signals are never lost.
+ */
+
+/*!
+ * \fn void UnixSignalWatcher::timerExpired(int id, int expirations)
+ * Emitted when the timer \a id started with watchTimer() has expired
+ * \a expirations times since it was last emitted, after the signals received
+ * in the same wakeup.
+ */
+
+/*!
+ * \fn void UnixSignalWatcher::unixSignalInfo(const UnixSignalInfo &info)
+ * Emitted after unixSignal() for a signal watched with SignalInfo, with the
+ * details of the delivery in \a info. For \c SIGCHLD, for example, \c info.pid
+ * identifies the child that changed state.
+ */
+
+/*!
+ * \fn void UnixSignalWatcher::unixSignalCoalesced(int signal, int count)
+ * Emitted after unixSignal() for a signal watched with CoalesceSignals. The
+ * \a count is the number of times the Unix \a signal was received since it was
+ * last emitted, and is always at least one.
+ */
+
+/*!
+ * \fn void UnixSignalWatcher::unixSignalsBatch(const QVector<int> &signalBatch)
+ * Emitted once per wakeup with every Unix signal received since the previous
+ * wakeup, in the order they were received.
+ *
+ * This is emitted after unixSignal() has been emitted for each signal in the
+ * batch. Under a burst of signals, connecting to this signal lets a slot handle
+ * the whole burst in a single call.
+ */
+
 /*!
  * \fn void UnixSignalWatcher::unixSignal(int signal)
  * Emitted when the given Unix \a signal is received.
@@ -26,7 +26,12 @@
 #define SIGWATCH_H
 
 #include <QObject>
+#include <QVariant>
+#include <QVector>
+#include <functional>
+#include <initializer_list>
 #include <signal.h>
+#include "sigcore.h"
 
 class UnixSignalWatcherPrivate;
 
@@ -36,26 +41,92 @@ class UnixSignalWatcherPrivate;
  *
  * To watch for a given signal, e.g. \c SIGINT, call \c watchForSignal(SIGINT)
  * and \c connect() your handler to unixSignal() or one of the specific signals.
+ *
+ * Several watchers may exist at the same time, for example one per subsystem.
+ * Each of them is notified of the signals it watches.
+ *
+ * Signals are read and emitted in the thread the watcher lives in. To handle
+ * them away from a busy main thread, move the watcher to a dedicated QThread
+ * with QObject::moveToThread(); receivers living in that thread are then
+ * called directly, without a queued connection.
+ *
+ * The signals are caught by a UnixSignalCore, which can also be used on its
+ * own with other event loops.
  */
 
 class UnixSignalWatcher : public QObject
 {
     Q_OBJECT
     Q_DECLARE_PRIVATE(UnixSignalWatcher)
+    Q_PROPERTY(QVariantMap statistics READ statisticsMap)
 
 public:
+    enum WatchOption {
+        NoWatchOptions  = UnixSignalCore::NoWatchOptions,
+        CoalesceSignals = UnixSignalCore::CoalesceSignals,
+        SignalInfo      = UnixSignalCore::SignalInfo,
+        QueueSignals    = UnixSignalCore::QueueSignals,
+        HighPriority    = UnixSignalCore::HighPriority
+    };
+    Q_DECLARE_FLAGS(WatchOptions, WatchOption)
+
+    enum ForkPolicy {
+        RearmInChild   = UnixSignalCore::RearmInChild,
+        DisableInChild = UnixSignalCore::DisableInChild
+    };
+
+    typedef std::function<void(const UnixSignalInfo &)> SignalHandler;
+
     explicit UnixSignalWatcher(QObject *parent = 0);
     ~UnixSignalWatcher();
 
-    void watchForSignal(int signal);
+    void watchForSignal(int signal, WatchOptions options = NoWatchOptions);
+    void watchForSignals(const QList<int> &signalList, WatchOptions options = NoWatchOptions);
+    void watchForSignals(std::initializer_list<int> signalList, WatchOptions options = NoWatchOptions);
+#ifdef Q_OS_UNIX
+    void watchForSignals(const sigset_t &signalSet, WatchOptions options = NoWatchOptions);
+#endif
+    void unwatchSignal(int signal);
+    void watchForSignal(int signal, const SignalHandler &handler,
+                        WatchOptions options = NoWatchOptions);
+    template <typename Receiver>
+    void watchForSignal(int signal, Receiver *receiver,
+                        void (Receiver::*method)(const UnixSignalInfo &),
+                        WatchOptions options = NoWatchOptions)
+    {
+        watchForSignal(signal, [receiver, method](const UnixSignalInfo &info) {
+            (receiver->*method)(info);
+        }, options);
+    }
+
+    int watchTimer(int interval);
+    void unwatchTimer(int id);
 
     void watchForInterrupt();
     void watchForTerminate();
     void watchForHangup();
     void watchForBreak();
 
+    UnixSignalStatistics statistics(int signal) const;
+    UnixSignalLatencyHistogram latencyHistogram(int signal) const;
+    QVariantMap statisticsMap() const;
+    QByteArray prometheusMetrics() const;
+
+    static int realTimeSignal(int offset);
+    static bool queueSignal(qint64 pid, int signal, int value);
+
+    static bool blockWatchedSignals();
+    static bool unblockWatchedSignals();
+
+    static void setForkPolicy(ForkPolicy policy);
+
 signals:
     void unixSignal(int signal);
+    void unixSignalsBatch(const QVector<int> &signalBatch);
+    void unixSignalCoalesced(int signal, int count);
+    void unixSignalInfo(const UnixSignalInfo &info);
+    void unixSignalsDropped(int signal, int count);
+    void timerExpired(int id, int expirations);
 
     void interrupted();     // SIGINT
     void terminated();      // SIGTERM
@@ -67,4 +138,7 @@ private:
     Q_PRIVATE_SLOT(d_func(), void _q_onNotify(int))
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(UnixSignalWatcher::WatchOptions)
+Q_DECLARE_METATYPE(UnixSignalInfo)
+
 #endif // SIGWATCH_H
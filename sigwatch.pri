@@ -1,3 +1,23 @@
-SOURCES += $$PWD/sigwatch.cpp
+include($$PWD/sigcore.pri)
 
-HEADERS += $$PWD/sigwatch.h
+SOURCES += $$PWD/sigwatch.cpp \
+    $$PWD/sigshutdown.cpp \
+    $$PWD/sigreload.cpp
+
+HEADERS += $$PWD/sigwatch.h \
+    $$PWD/sigshutdown.h \
+    $$PWD/sigreload.h
+
+unix {
+    SOURCES += $$PWD/sigreap.cpp \
+        $$PWD/sigsample.cpp
+    HEADERS += $$PWD/sigreap.h \
+        $$PWD/sigsample.h
+
+    # timer_create(2) is in librt before glibc 2.17
+    linux: LIBS += -lrt
+}
+
+# Wake up for the signals and the timers of a watcher through a single epoll(7)
+# set, the timers being timerfd(2)s (Linux only).
+linux:sigwatch_epoll: DEFINES += SIGWATCH_EPOLL
@@ -0,0 +1,102 @@
+/*
+ * Boost.Asio adapter for the Unix signal core.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGWATCHASIO_H
+#define SIGWATCHASIO_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include "sigcore.h"
+
+
+/*!
+ * \brief The UnixSignalAsioWatcher class drains a UnixSignalCore from a
+ * Boost.Asio \c io_context.
+ *
+ * It waits for the core's descriptor to become readable, without reading it,
+ * and calls UnixSignalCore::drain() with the callback from the thread running
+ * the \c io_context, so no Qt event loop is involved. Header-only; requires
+ * Boost 1.66 or later. The core must outlive the adapter.
+ *
+ * After \c fork(), the core's descriptor keeps its number; the child only has
+ * to call \c notify_fork() on the \c io_context, as for any other descriptor.
+ *
+ * \code
+ * UnixSignalCore core;
+ * core.watchSignal(SIGTERM);
+ * UnixSignalAsioWatcher watcher(context, core, [&](const UnixSignalInfo &, int) {
+ *     context.stop();
+ * });
+ * context.run();
+ * \endcode
+ */
+class UnixSignalAsioWatcher
+{
+public:
+    UnixSignalAsioWatcher(boost::asio::io_context &context, UnixSignalCore &core,
+                          const UnixSignalCore::Callback &callback,
+                          const UnixSignalCore::DroppedCallback &dropped = UnixSignalCore::DroppedCallback()) :
+        core(core),
+        callback(callback),
+        dropped(dropped),
+        descriptor(context)
+    {
+        if (core.fd() < 0)
+            return;
+        descriptor.assign(core.fd());
+        wait();
+    }
+
+    ~UnixSignalAsioWatcher()
+    {
+        // The descriptor belongs to the core
+        boost::system::error_code error;
+        descriptor.cancel(error);
+        if (descriptor.is_open())
+            descriptor.release();
+    }
+
+private:
+    UnixSignalAsioWatcher(const UnixSignalAsioWatcher &);
+    UnixSignalAsioWatcher &operator=(const UnixSignalAsioWatcher &);
+
+    void wait()
+    {
+        descriptor.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                              [this](const boost::system::error_code &error) {
+            // Cancelled when the adapter is destroyed, do not touch it then
+            if (error)
+                return;
+            core.drain(callback, dropped);
+            wait();
+        });
+    }
+
+    UnixSignalCore &core;
+    UnixSignalCore::Callback callback;
+    UnixSignalCore::DroppedCallback dropped;
+    boost::asio::posix::stream_descriptor descriptor;
+};
+
+#endif // SIGWATCHASIO_H
@@ -0,0 +1,105 @@
+/*
+ * epoll(7) adapter for the Unix signal core.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGWATCHEPOLL_H
+#define SIGWATCHEPOLL_H
+
+#include <QDebug>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include "sigcore.h"
+
+
+/*!
+ * \brief The UnixSignalEpollWatcher class drains a UnixSignalCore from a raw
+ * \c epoll(7) event loop (Linux only).
+ *
+ * It adds the core's descriptor to the given epoll set with the adapter as
+ * \c data.ptr. When \c epoll_wait() reports an event for which handles() is
+ * true, call dispatch() to drain the core. Header-only; the core must outlive
+ * the adapter. An epoll set is shared with the parent after \c fork(), so a
+ * child should create its own adapter on an epoll set of its own.
+ *
+ * \code
+ * UnixSignalEpollWatcher watcher(epollFd, core, onSignal);
+ * for (;;) {
+ *     struct epoll_event events[16];
+ *     const int count = epoll_wait(epollFd, events, 16, -1);
+ *     for (int i = 0; i < count; ++i) {
+ *         if (watcher.handles(events[i]))
+ *             watcher.dispatch();
+ *         else
+ *             handleOther(events[i]);
+ *     }
+ * }
+ * \endcode
+ */
+class UnixSignalEpollWatcher
+{
+public:
+    UnixSignalEpollWatcher(int epollFd, UnixSignalCore &core,
+                           const UnixSignalCore::Callback &callback,
+                           const UnixSignalCore::DroppedCallback &dropped = UnixSignalCore::DroppedCallback()) :
+        epollFd(epollFd),
+        core(core),
+        callback(callback),
+        dropped(dropped),
+        added(false)
+    {
+        if (core.fd() < 0)
+            return;
+
+        // Level-triggered: the descriptor stays readable until drained
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = this;
+        if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, core.fd(), &event))
+            qWarning() << "UnixSignalEpollWatcher: epoll_ctl: " << ::strerror(errno);
+        else
+            added = true;
+    }
+
+    ~UnixSignalEpollWatcher()
+    {
+        if (added)
+            ::epoll_ctl(epollFd, EPOLL_CTL_DEL, core.fd(), NULL);
+    }
+
+    bool isValid() const { return added; }
+    bool handles(const struct epoll_event &event) const { return event.data.ptr == this; }
+    int dispatch() { return core.drain(callback, dropped); }
+
+private:
+    UnixSignalEpollWatcher(const UnixSignalEpollWatcher &);
+    UnixSignalEpollWatcher &operator=(const UnixSignalEpollWatcher &);
+
+    int epollFd;
+    UnixSignalCore &core;
+    UnixSignalCore::Callback callback;
+    UnixSignalCore::DroppedCallback dropped;
+    bool added;
+};
+
+#endif // SIGWATCHEPOLL_H
@@ -0,0 +1,215 @@
+/*
+ * Lightweight, header-only Unix signal watcher for Qt.
+ *
+ * Copyright (C) 2014 Simon Knopp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGWATCHLITE_H
+#define SIGWATCHLITE_H
+
+#include <QtGlobal>
+#include <QDebug>
+#include <QSocketNotifier>
+
+#include <atomic>
+#include <bitset>
+#include <initializer_list>
+#include <new>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*!
+ * \brief The UnixSignalWatcherLite class calls a function for Unix signals,
+ * with no moc, no source file and no allocation of its own.
+ *
+ * It is meant for short-lived processes where the setup of UnixSignalWatcher
+ * shows: the signals are given once, at construction, typically from a
+ * constant array, and each caught signal is passed to a plain function in the
+ * thread the watcher was created in.
+ *
+ * \code
+ * static void onSignal(int signal, void *) { QCoreApplication::quit(); }
+ *
+ * static const int quitSignals[] = { SIGINT, SIGTERM };
+ * UnixSignalWatcherLite sigwatch(quitSignals, onSignal);
+ * \endcode
+ *
+ * The handler writes the signal number to a non-blocking pipe watched by a
+ * QSocketNotifier held by value. Deliveries of a signal are coalesced until
+ * the function has been called for it, so the pipe never fills up. Only one
+ * instance may exist at a time, and it must not watch the same signals as a
+ * UnixSignalWatcher; check isValid() after construction. The previous
+ * dispositions are restored on destruction.
+ */
+class UnixSignalWatcherLite
+{
+public:
+    typedef void (*Handler)(int signal, void *context);
+
+    template <size_t N>
+    UnixSignalWatcherLite(const int (&signalList)[N], Handler handler, void *context = 0) :
+        handler(handler), context(context)
+    {
+        start(signalList, N);
+    }
+
+    UnixSignalWatcherLite(std::initializer_list<int> signalList, Handler handler, void *context = 0) :
+        handler(handler), context(context)
+    {
+        start(signalList.begin(), int(signalList.size()));
+    }
+
+    ~UnixSignalWatcherLite()
+    {
+        for (int i = 1; i < NSIG; ++i) {
+            if (watched.test(i))
+                ::sigaction(i, &previous[i], NULL);
+        }
+        if (isValid()) {
+            writeFd().store(-1);
+            notifier.~QSocketNotifier();
+            ::close(pipeReadFd);
+            ::close(pipeWriteFd);
+            instance().store(false);
+        }
+    }
+
+    // False if the pipe could not be opened or another instance exists
+    bool isValid() const
+    {
+        return pipeReadFd >= 0;
+    }
+
+    bool isWatching(int signal) const
+    {
+        return signal > 0 && signal < NSIG && watched.test(signal);
+    }
+
+private:
+    Q_DISABLE_COPY(UnixSignalWatcherLite)
+
+    // Process-wide state shared with the signal handler
+    static std::atomic<int> &writeFd() { static std::atomic<int> fd(-1); return fd; }
+    static std::atomic<bool> *pending() { static std::atomic<bool> flags[NSIG]; return flags; }
+    static std::atomic<bool> &instance() { static std::atomic<bool> exists(false); return exists; }
+
+    bool openPipe()
+    {
+        pipeReadFd = pipeWriteFd = -1;
+        if (instance().exchange(true)) {
+            qWarning("UnixSignalWatcherLite: only one instance may exist at a time");
+            return false;
+        }
+
+        int fds[2];
+#if defined(Q_OS_LINUX) || defined(Q_OS_FREEBSD) || defined(Q_OS_NETBSD) || defined(Q_OS_OPENBSD)
+        if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC)) {
+            qWarning("UnixSignalWatcherLite: pipe2: %s", ::strerror(errno));
+            instance().store(false);
+            return false;
+        }
+#else
+        if (::pipe(fds)) {
+            qWarning("UnixSignalWatcherLite: pipe: %s", ::strerror(errno));
+            instance().store(false);
+            return false;
+        }
+        for (int i = 0; i < 2; ++i) {
+            ::fcntl(fds[i], F_SETFL, ::fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+            ::fcntl(fds[i], F_SETFD, ::fcntl(fds[i], F_GETFD) | FD_CLOEXEC);
+        }
+#endif
+        pipeReadFd = fds[0];
+        pipeWriteFd = fds[1];
+        return true;
+    }
+
+    void start(const int *signalList, int count)
+    {
+        if (!openPipe())
+            return;
+        new (&notifier) QSocketNotifier(pipeReadFd, QSocketNotifier::Read);
+        writeFd().store(pipeWriteFd);
+
+        for (int i = 0; i < count; ++i) {
+            const int signal = signalList[i];
+            if (signal <= 0 || signal >= NSIG || watched.test(signal))
+                continue;
+
+            pending()[signal].store(false);
+            struct sigaction sigact;
+            sigact.sa_handler = UnixSignalWatcherLite::signalHandler;
+            ::sigemptyset(&sigact.sa_mask);
+            sigact.sa_flags = SA_RESTART;
+            if (::sigaction(signal, &sigact, &previous[signal])) {
+                qWarning("UnixSignalWatcherLite: sigaction: %s", ::strerror(errno));
+                continue;
+            }
+            watched.set(signal);
+        }
+
+        QObject::connect(&notifier, &QSocketNotifier::activated, [this]() { readSignals(); });
+    }
+
+    // Async-signal-safe: one byte per signal until it has been handled
+    static void signalHandler(int signal)
+    {
+        if (pending()[signal].exchange(true))
+            return;
+
+        const int savedErrno = errno;
+        const unsigned char byte = (unsigned char)signal;
+        ssize_t nBytes = ::write(writeFd().load(), &byte, 1);
+        Q_UNUSED(nBytes);
+        errno = savedErrno;
+    }
+
+    void readSignals()
+    {
+        unsigned char buffer[NSIG];
+        ssize_t nBytes;
+        while ((nBytes = ::read(pipeReadFd, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t i = 0; i < nBytes; ++i) {
+                // Re-arm before the call so that a new delivery is not lost
+                pending()[buffer[i]].store(false);
+                handler(buffer[i], context);
+            }
+        }
+    }
+
+    Handler handler;
+    void *context;
+    int pipeReadFd;
+    int pipeWriteFd;
+    std::bitset<NSIG> watched;
+    struct sigaction previous[NSIG];
+
+    // Constructed in place once the pipe is open, so that no notifier ever
+    // watches an invalid descriptor
+    union { QSocketNotifier notifier; };
+};
+
+#endif // SIGWATCHLITE_H
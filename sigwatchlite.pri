@@ -0,0 +1,4 @@
+# Header-only UnixSignalWatcherLite: no moc and no sources to build.
+HEADERS += $$PWD/sigwatchlite.h
+
+CONFIG += c++11